@@ -0,0 +1,40 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+
+namespace bench {
+
+template <typename T>
+void do_not_optimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  static_cast<void>(*static_cast<const volatile T*>(&value));
+#endif
+}
+
+// Runs `body` once and returns the average time of one of its `ops` operations.
+template <typename F>
+double ns_per_op(std::size_t ops, F&& body) {
+  auto start = std::chrono::steady_clock::now();
+  body();
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / static_cast<double>(ops);
+}
+
+// Best of several runs, which is far more stable than the mean on a loaded machine.
+template <typename F>
+double best_ns_per_op(std::size_t ops, F&& body, int runs = 5) {
+  double best = ns_per_op(ops, body);
+  for (int i = 1; i < runs; ++i) {
+    double current = ns_per_op(ops, body);
+    if (current < best) {
+      best = current;
+    }
+  }
+  return best;
+}
+
+} // namespace bench
@@ -0,0 +1,65 @@
+// Compares handle-by-handle copying and resetting against retain_all/release_all.
+//
+// "fan-out" copies one object into every slot, "interleaved" and "24 objects" cycle through a few
+// objects, and "distinct" gives every slot its own object, where batching has nothing to coalesce
+// and shows its bookkeeping overhead instead.
+
+#include "bench-util.h"
+#include "shared-ptr.h"
+
+#include <cstdio>
+#include <vector>
+
+namespace {
+
+std::vector<shared_ptr<int>> make_source(std::size_t size, std::size_t distinct) {
+  std::vector<shared_ptr<int>> objects;
+  for (std::size_t i = 0; i < distinct; ++i) {
+    objects.emplace_back(new int(static_cast<int>(i)));
+  }
+  std::vector<shared_ptr<int>> source;
+  source.reserve(size);
+  for (std::size_t i = 0; i < size; ++i) {
+    source.push_back(objects[i % distinct]);
+  }
+  return source;
+}
+
+double one_by_one_ns(const std::vector<shared_ptr<int>>& source) {
+  std::vector<shared_ptr<int>> target(source.size());
+  return bench::best_ns_per_op(source.size(), [&] {
+    for (std::size_t i = 0; i < source.size(); ++i) {
+      target[i] = source[i];
+    }
+    for (auto& handle : target) {
+      handle.reset();
+    }
+    bench::do_not_optimize(target);
+  });
+}
+
+double batched_ns(const std::vector<shared_ptr<int>>& source) {
+  std::vector<shared_ptr<int>> target(source.size());
+  return bench::best_ns_per_op(source.size(), [&] {
+    retain_all(source, target);
+    release_all(target);
+    bench::do_not_optimize(target);
+  });
+}
+
+void run(const char* name, std::size_t distinct) {
+  constexpr std::size_t size = 1 << 16;
+  auto source = make_source(size, distinct);
+  std::printf("%-12s %12.2f %12.2f\n", name, one_by_one_ns(source), batched_ns(source));
+}
+
+} // namespace
+
+int main() {
+  std::printf("retain + release, ns/handle\n");
+  std::printf("%-12s %12s %12s\n", "pattern", "one-by-one", "batched");
+  run("fan-out", 1);
+  run("interleaved", 4);
+  run("24 objects", 24);
+  run("distinct", 1 << 16);
+}
@@ -0,0 +1,106 @@
+// Compares packed and cache-aligned shared_ptr control blocks.
+//
+// The contended run gives every thread its own object, but the objects are created back to back,
+// so packed control blocks end up on shared cache lines. The scan run touches each control block
+// of a large set once, where the smaller packed blocks win by fitting more of the set into cache.
+// The crossover is where the "winner" column flips.
+
+#include "bench-util.h"
+#include "shared-ptr.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct cold_object {
+  int value;
+};
+
+struct hot_object {
+  int value;
+};
+
+} // namespace
+
+template <>
+struct control_block_layout_traits<hot_object> {
+  static constexpr control_block_layout value = control_block_layout::cache_aligned;
+};
+
+namespace {
+
+template <typename T>
+double contended_ns_per_copy(std::size_t threads, std::size_t copies_per_thread) {
+  std::vector<shared_ptr<T>> objects;
+  objects.reserve(threads);
+  for (std::size_t i = 0; i < threads; ++i) {
+    objects.emplace_back(new T{static_cast<int>(i)});
+  }
+
+  std::atomic<std::size_t> ready{0};
+  auto body = [&] {
+    std::vector<std::thread> workers;
+    ready.store(0);
+    for (std::size_t i = 0; i < threads; ++i) {
+      workers.emplace_back([&, i] {
+        ready.fetch_add(1);
+        while (ready.load() != threads) {}
+        for (std::size_t j = 0; j < copies_per_thread; ++j) {
+          shared_ptr<T> copy = objects[i];
+          bench::do_not_optimize(copy);
+        }
+      });
+    }
+    for (auto& worker : workers) {
+      worker.join();
+    }
+  };
+  return bench::best_ns_per_op(copies_per_thread, body, 3);
+}
+
+template <typename T>
+double scan_ns_per_copy(std::size_t objects_count) {
+  std::vector<shared_ptr<T>> objects;
+  objects.reserve(objects_count);
+  for (std::size_t i = 0; i < objects_count; ++i) {
+    objects.emplace_back(new T{static_cast<int>(i)});
+  }
+
+  std::size_t rounds = std::max<std::size_t>(1, (std::size_t{1} << 22) / objects_count);
+  return bench::best_ns_per_op(rounds * objects_count, [&] {
+    for (std::size_t r = 0; r < rounds; ++r) {
+      for (const auto& object : objects) {
+        shared_ptr<T> copy = object;
+        bench::do_not_optimize(copy);
+      }
+    }
+  });
+}
+
+void print_row(std::size_t parameter, double packed, double aligned) {
+  std::printf("%10zu %12.2f %12.2f %10s\n", parameter, packed, aligned, packed <= aligned ? "packed" : "aligned");
+}
+
+} // namespace
+
+int main() {
+  constexpr std::size_t copies_per_thread = 1 << 21;
+  std::size_t max_threads = std::max(2u, std::thread::hardware_concurrency());
+
+  std::printf("contended copies, ns/copy\n");
+  std::printf("%10s %12s %12s %10s\n", "threads", "packed", "aligned", "winner");
+  for (std::size_t threads = 1; threads <= max_threads; threads *= 2) {
+    print_row(threads, contended_ns_per_copy<cold_object>(threads, copies_per_thread),
+              contended_ns_per_copy<hot_object>(threads, copies_per_thread));
+  }
+
+  std::printf("\nsingle-threaded scan, ns/copy\n");
+  std::printf("%10s %12s %12s %10s\n", "objects", "packed", "aligned", "winner");
+  for (std::size_t objects = 1 << 10; objects <= (1 << 22); objects *= 4) {
+    print_row(objects, scan_ns_per_copy<cold_object>(objects), scan_ns_per_copy<hot_object>(objects));
+  }
+}
@@ -0,0 +1,111 @@
+// Compares the doubly- and singly-linked ring layouts of linked_ptr.
+//
+// Graph nodes embedding a linked_ptr are allocated in a shuffled order, so ring neighbours are
+// scattered across memory. Every node's handle is copy-constructed from an owner of its object,
+// then all nodes are reassigned and finally destroyed in another shuffled order. The singly-linked
+// layout saves a pointer per node but walks the ring on every release, so it only pays off for
+// short rings.
+
+#include "bench-util.h"
+#include "linked-ptr.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+
+struct doubly_object {
+  int value;
+};
+
+struct singly_object {
+  int value;
+};
+
+} // namespace
+
+template <>
+struct ring_layout_traits<singly_object> {
+  static constexpr ring_layout value = ring_layout::singly_linked;
+};
+
+namespace {
+
+template <typename T>
+struct graph_node {
+  linked_ptr<T> payload;
+  int weight;
+};
+
+struct timings {
+  double copy;
+  double assign;
+  double destroy;
+};
+
+template <typename T>
+timings run(std::size_t nodes_count, std::size_t ring_size) {
+  std::mt19937 rng(42);
+  std::size_t objects_count = nodes_count / ring_size;
+
+  std::vector<linked_ptr<T>> objects;
+  objects.reserve(objects_count);
+  for (std::size_t i = 0; i < objects_count; ++i) {
+    objects.emplace_back(new T{static_cast<int>(i)});
+  }
+
+  std::vector<std::unique_ptr<graph_node<T>>> storage(nodes_count);
+  std::vector<std::size_t> order(nodes_count);
+  for (std::size_t i = 0; i < nodes_count; ++i) {
+    order[i] = i;
+  }
+  std::shuffle(order.begin(), order.end(), rng);
+  for (std::size_t i : order) {
+    storage[i] = std::make_unique<graph_node<T>>();
+  }
+
+  // The payloads are copy-constructed in place: the timed loop doesn't include allocating nodes.
+  for (auto& node : storage) {
+    std::destroy_at(&node->payload);
+  }
+  timings result{};
+  result.copy = bench::ns_per_op(nodes_count, [&] {
+    for (std::size_t i = 0; i < nodes_count; ++i) {
+      std::construct_at(&storage[i]->payload, objects[i % objects_count]);
+    }
+  });
+  std::shuffle(order.begin(), order.end(), rng);
+  result.assign = bench::ns_per_op(nodes_count, [&] {
+    for (std::size_t i : order) {
+      storage[i]->payload = objects[(i + 1) % objects_count];
+    }
+  });
+  objects.clear();
+  std::shuffle(order.begin(), order.end(), rng);
+  result.destroy = bench::ns_per_op(nodes_count, [&] {
+    for (std::size_t i : order) {
+      storage[i]->payload.reset();
+    }
+  });
+  return result;
+}
+
+} // namespace
+
+int main() {
+  constexpr std::size_t nodes_count = 1 << 20;
+
+  std::printf("sizeof(linked_ptr): doubly-linked %zu, singly-linked %zu\n\n", sizeof(linked_ptr<doubly_object>),
+              sizeof(linked_ptr<singly_object>));
+  std::printf("%6s | %25s | %25s\n", "", "doubly-linked, ns/node", "singly-linked, ns/node");
+  std::printf("%6s | %7s %8s %8s | %7s %8s %8s\n", "ring", "copy", "assign", "destroy", "copy", "assign", "destroy");
+  for (std::size_t ring_size : {2, 4, 8, 16, 64}) {
+    timings doubly = run<doubly_object>(nodes_count, ring_size);
+    timings singly = run<singly_object>(nodes_count, ring_size);
+    std::printf("%6zu | %7.2f %8.2f %8.2f | %7.2f %8.2f %8.2f\n", ring_size, doubly.copy, doubly.assign,
+                doubly.destroy, singly.copy, singly.assign, singly.destroy);
+  }
+}
@@ -0,0 +1,68 @@
+// Compares where shared_ptr control blocks and objects come from.
+//
+// Each round models one request: it creates a batch of small objects, hands a copy of each to a
+// second owner and drops everything again. "heap" allocates the object and its control block
+// separately, "make_shared" does both at once, the remaining rows use allocate_shared with a
+// memory resource. The monotonic arena is rewound after every round, as a per-request arena would.
+
+#include "bench-util.h"
+#include "shared-ptr.h"
+
+#include <cstdio>
+#include <memory_resource>
+#include <vector>
+
+namespace {
+
+struct message {
+  long id;
+  long payload[5];
+};
+
+constexpr std::size_t batch_size = 256;
+constexpr std::size_t rounds = 4096;
+
+template <typename Make, typename Rewind>
+double run(Make make, Rewind rewind) {
+  std::vector<shared_ptr<message>> owners(batch_size);
+  std::vector<shared_ptr<message>> copies(batch_size);
+  return bench::best_ns_per_op(batch_size * rounds, [&] {
+    for (std::size_t round = 0; round < rounds; ++round) {
+      for (std::size_t i = 0; i < batch_size; ++i) {
+        owners[i] = make(static_cast<long>(i));
+        copies[i] = owners[i];
+      }
+      bench::do_not_optimize(copies);
+      release_all(owners);
+      release_all(copies);
+      rewind();
+    }
+  });
+}
+
+} // namespace
+
+int main() {
+  auto nothing = [] {};
+  std::printf("create, copy and release, ns/object\n");
+
+  std::printf("%-24s %8.2f\n", "heap",
+              run([](long id) { return shared_ptr<message>(new message{id, {}}); }, nothing));
+
+  std::printf("%-24s %8.2f\n", "make_shared",
+              run([](long id) { return make_shared<message>(message{id, {}}); }, nothing));
+
+  std::pmr::monotonic_buffer_resource arena;
+  std::printf("%-24s %8.2f\n", "monotonic",
+              run([&arena](long id) { return allocate_shared<message>(&arena, message{id, {}}); },
+                  [&arena] { arena.release(); }));
+
+  std::pmr::unsynchronized_pool_resource pool;
+  std::printf("%-24s %8.2f\n", "unsynchronized pool",
+              run([&pool](long id) { return allocate_shared<message>(&pool, message{id, {}}); }, nothing));
+
+  std::pmr::synchronized_pool_resource shared_pool;
+  std::printf("%-24s %8.2f\n", "synchronized pool", run([&shared_pool](long id) {
+                return allocate_shared<message>(&shared_pool, message{id, {}});
+              }, nothing));
+}
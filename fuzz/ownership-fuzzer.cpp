@@ -0,0 +1,336 @@
+// Decodes the input into a sequence of operations on a few slots of `shared_ptr` and `linked_ptr`
+// handles and checks every step against a reference model of who owns what.
+//
+// There are three families of slots: shared_ptr<destruction_tracker>, and two kinds of linked_ptr
+// handles, to the derived and to the base class, that may join the same ring through converting
+// copies and assignments. The model is a handful of fixed arrays: apart from the objects and
+// control blocks under test, an execution allocates nothing.
+
+#include "linked-ptr.h"
+#include "shared-ptr.h"
+#include "test-classes.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <optional>
+#include <utility>
+
+namespace {
+
+constexpr std::size_t slots_count = 8;
+constexpr std::size_t max_objects = 64;
+
+using shared_handle = shared_ptr<destruction_tracker>;
+using derived_handle = linked_ptr<destruction_tracker, std::default_delete<destruction_tracker_base>>;
+using base_handle = linked_ptr<destruction_tracker_base>;
+
+enum family : std::uint8_t {
+  shared_family,
+  derived_family,
+  base_family,
+  families_count,
+};
+
+enum operation : std::uint8_t {
+  construct,
+  copy_construct,
+  copy_assign,
+  move_assign,
+  reset,
+  destroy,
+  self_assign,
+  operations_count,
+};
+
+[[noreturn]] void fail(const char* what, std::size_t index) {
+  std::fprintf(stderr, "ownership invariant violated: %s (#%zu)\n", what, index);
+  std::abort();
+}
+
+class byte_reader {
+public:
+  byte_reader(const std::uint8_t* data, std::size_t size) noexcept : data(data), size(size) {}
+
+  bool empty() const noexcept {
+    return position == size;
+  }
+
+  std::uint8_t next() noexcept {
+    return position < size ? data[position++] : 0;
+  }
+
+private:
+  const std::uint8_t* data;
+  std::size_t size;
+  std::size_t position{0};
+};
+
+// What the handles should look like. A slot is either disengaged, holds an empty handle (`no_object`)
+// or owns one of the objects.
+struct reference_model {
+  static constexpr int no_object = -1;
+
+  struct slot {
+    bool engaged;
+    int object;
+  };
+
+  slot slots[families_count][slots_count]{};
+  const destruction_tracker_base* address[max_objects]{};
+  std::size_t owners[max_objects]{};
+  bool destroyed[max_objects]{};
+  std::size_t created{0};
+
+  void release(slot& s) noexcept {
+    if (s.engaged && s.object != no_object) {
+      --owners[s.object];
+    }
+    s.object = no_object;
+  }
+
+  void assign(slot& target, int object) noexcept {
+    if (object != no_object) {
+      ++owners[object];
+    }
+    release(target);
+    target.object = object;
+  }
+};
+
+class harness {
+public:
+  ~harness() {
+    for (std::size_t i = 0; i < slots_count; ++i) {
+      shared[i].reset();
+      derived[i].reset();
+      base[i].reset();
+      model.release(model.slots[shared_family][i]);
+      model.release(model.slots[derived_family][i]);
+      model.release(model.slots[base_family][i]);
+    }
+    check_objects();
+  }
+
+  void run(byte_reader& input) {
+    while (!input.empty()) {
+      std::uint8_t op = input.next();
+      std::uint8_t target = input.next();
+      std::uint8_t source = input.next();
+      auto target_family = static_cast<family>(target % families_count);
+      std::size_t target_slot = (target / families_count) % slots_count;
+      apply(static_cast<operation>(op % operations_count), target_family, target_slot, source);
+      check_family(target_family, target_slot);
+      check_objects();
+    }
+  }
+
+private:
+  void apply(operation op, family f, std::size_t slot, std::uint8_t source) {
+    reference_model::slot& s = model.slots[f][slot];
+    // Only linked handles to the base class have a second family to copy from: a converting copy
+    // from the derived class. Every other family copies from itself.
+    family source_family = f == base_family && source % 2 == 1 ? derived_family : f;
+    std::size_t source_slot = (source / 2) % slots_count;
+    reference_model::slot& from = model.slots[source_family][source_slot];
+
+    switch (op) {
+    case construct: {
+      if (model.created == max_objects) {
+        return;
+      }
+      int object = static_cast<int>(model.created++);
+      bool* deleted = &model.destroyed[object];
+      engage(f, slot);
+      if (f == shared_family && source % 2 == 1) {
+        *shared[slot] = make_shared<destruction_tracker>(deleted);
+        model.address[object] = shared[slot]->get();
+      } else {
+        auto* ptr = new destruction_tracker(deleted);
+        model.address[object] = ptr;
+        if (f == shared_family) {
+          shared[slot]->reset(ptr);
+        } else if (f == derived_family) {
+          derived[slot]->reset(ptr);
+        } else {
+          base[slot]->reset(ptr);
+        }
+      }
+      model.assign(s, object);
+      return;
+    }
+    case copy_construct:
+      // `emplace` destroys the target first, so a slot can't be copied into itself.
+      if (!from.engaged || &s == &from) {
+        return;
+      }
+      if (f == shared_family) {
+        shared[slot].emplace(*shared[source_slot]);
+      } else if (f == derived_family) {
+        derived[slot].emplace(*derived[source_slot]);
+      } else if (source_family == derived_family) {
+        base[slot].emplace(*derived[source_slot]);
+      } else {
+        base[slot].emplace(*base[source_slot]);
+      }
+      model.release(s);
+      s.engaged = true;
+      model.assign(s, from.object);
+      return;
+    case copy_assign:
+    case move_assign:
+      if (!from.engaged) {
+        return;
+      }
+      engage(f, slot);
+      if (f == shared_family) {
+        if (op == move_assign) {
+          *shared[slot] = std::move(*shared[source_slot]);
+        } else {
+          *shared[slot] = *shared[source_slot];
+        }
+      } else if (f == derived_family) {
+        *derived[slot] = *derived[source_slot];
+      } else if (source_family == derived_family) {
+        *base[slot] = *derived[source_slot];
+      } else {
+        *base[slot] = *base[source_slot];
+      }
+      if (&s != &from) {
+        int object = from.object;
+        model.assign(s, object);
+        // Only shared_ptr has a move assignment, linked_ptr copies.
+        if (op == move_assign && f == shared_family) {
+          model.release(from);
+        }
+      }
+      return;
+    case reset:
+      if (!s.engaged) {
+        return;
+      }
+      if (f == shared_family) {
+        shared[slot]->reset();
+      } else if (f == derived_family) {
+        derived[slot]->reset();
+      } else {
+        base[slot]->reset();
+      }
+      model.release(s);
+      return;
+    case destroy:
+      if (f == shared_family) {
+        shared[slot].reset();
+      } else if (f == derived_family) {
+        derived[slot].reset();
+      } else {
+        base[slot].reset();
+      }
+      model.release(s);
+      s.engaged = false;
+      return;
+    case self_assign:
+      if (!s.engaged) {
+        return;
+      }
+      if (f == shared_family) {
+        shared_handle& alias = *shared[slot];
+        *shared[slot] = alias;
+      } else if (f == derived_family) {
+        derived_handle& alias = *derived[slot];
+        *derived[slot] = alias;
+      } else {
+        base_handle& alias = *base[slot];
+        *base[slot] = alias;
+      }
+      return;
+    case operations_count:
+      break;
+    }
+  }
+
+  void engage(family f, std::size_t slot) {
+    reference_model::slot& s = model.slots[f][slot];
+    if (s.engaged) {
+      return;
+    }
+    if (f == shared_family) {
+      shared[slot].emplace();
+    } else if (f == derived_family) {
+      derived[slot].emplace();
+    } else {
+      base[slot].emplace();
+    }
+    s = {true, reference_model::no_object};
+  }
+
+  // An operation may change the count of any handle in a ring, but only the target changes what it
+  // compares equal to, so only its row of the equality matrix is checked.
+  template <typename Handle>
+  void check_handles(family f, const std::optional<Handle> (&handles)[slots_count], std::size_t touched) const {
+    for (std::size_t i = 0; i < slots_count; ++i) {
+      const reference_model::slot& s = model.slots[f][i];
+      if (s.engaged != handles[i].has_value()) {
+        fail("slot engagement", i);
+      }
+      if (!s.engaged) {
+        continue;
+      }
+      const Handle& handle = *handles[i];
+      bool owns = s.object != reference_model::no_object;
+      const destruction_tracker_base* expected = owns ? model.address[s.object] : nullptr;
+      if (static_cast<const destruction_tracker_base*>(handle.get()) != expected) {
+        fail("get()", i);
+      }
+      if (static_cast<bool>(handle) != owns) {
+        fail("operator bool", i);
+      }
+      if (handle.use_count() != (owns ? model.owners[s.object] : 0)) {
+        fail("use_count()", i);
+      }
+    }
+    const reference_model::slot& s = model.slots[f][touched];
+    if (!s.engaged) {
+      return;
+    }
+    for (std::size_t j = 0; j < slots_count; ++j) {
+      const reference_model::slot& other = model.slots[f][j];
+      if (other.engaged && (*handles[touched] == *handles[j]) != (s.object == other.object)) {
+        fail("operator==", touched);
+      }
+    }
+  }
+
+  void check_family(family f, std::size_t touched) const {
+    // Linked handles of both classes share rings, so one operation changes counts in both.
+    if (f == shared_family) {
+      check_handles(shared_family, shared, touched);
+    } else {
+      check_handles(derived_family, derived, touched);
+      check_handles(base_family, base, touched);
+    }
+  }
+
+  void check_objects() const {
+    for (std::size_t i = 0; i < model.created; ++i) {
+      if (model.destroyed[i] != (model.owners[i] == 0)) {
+        fail(model.destroyed[i] ? "object destroyed while owned" : "object leaked", i);
+      }
+    }
+  }
+
+  reference_model model;
+  std::optional<shared_handle> shared[slots_count];
+  std::optional<derived_handle> derived[slots_count];
+  std::optional<base_handle> base[slots_count];
+};
+
+} // namespace
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size) {
+  byte_reader input(data, size);
+  harness h;
+  h.run(input);
+  return 0;
+}
@@ -0,0 +1,121 @@
+// Runs a fuzz target without libFuzzer, for compilers that don't ship it and for quick nightly
+// runs. Files given on the command line are replayed once each; otherwise random inputs are
+// generated until the budget is spent. Either way the throughput is reported at the end.
+//
+// Flags follow libFuzzer's: -runs=N, -max_total_time=SECONDS, -max_len=BYTES, -seed=N. An input
+// that makes the target abort is saved to ./crash-input, and can be replayed by passing that file.
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const std::uint8_t* data, std::size_t size);
+
+namespace {
+
+struct options {
+  std::uint64_t runs = 0;
+  double max_total_time = 10;
+  std::size_t max_len = 1024;
+  std::uint64_t seed = 1;
+  std::vector<const char*> files;
+};
+
+bool parse_flag(const char* arg, const char* name, const char*& value) {
+  std::size_t length = std::strlen(name);
+  if (std::strncmp(arg, name, length) != 0 || arg[length] != '=') {
+    return false;
+  }
+  value = arg + length + 1;
+  return true;
+}
+
+options parse(int argc, char** argv) {
+  options result;
+  for (int i = 1; i < argc; ++i) {
+    const char* value = nullptr;
+    if (parse_flag(argv[i], "-runs", value)) {
+      result.runs = std::strtoull(value, nullptr, 10);
+    } else if (parse_flag(argv[i], "-max_total_time", value)) {
+      result.max_total_time = std::strtod(value, nullptr);
+    } else if (parse_flag(argv[i], "-max_len", value)) {
+      result.max_len = std::strtoull(value, nullptr, 10);
+    } else if (parse_flag(argv[i], "-seed", value)) {
+      result.seed = std::strtoull(value, nullptr, 10);
+    } else if (argv[i][0] == '-') {
+      std::fprintf(stderr, "ignoring unknown flag %s\n", argv[i]);
+    } else {
+      result.files.push_back(argv[i]);
+    }
+  }
+  return result;
+}
+
+const std::uint8_t* current_input = nullptr;
+std::size_t current_size = 0;
+
+extern "C" void save_current_input(int signal) {
+  if (std::FILE* file = std::fopen("crash-input", "wb")) {
+    std::fwrite(current_input, 1, current_size, file);
+    std::fclose(file);
+  }
+  std::signal(signal, SIG_DFL);
+  std::raise(signal);
+}
+
+void report(std::uint64_t execs, std::chrono::steady_clock::duration elapsed) {
+  double seconds = std::chrono::duration<double>(elapsed).count();
+  std::printf("%llu execs in %.2f s, %.0f execs/s\n", static_cast<unsigned long long>(execs), seconds,
+              seconds > 0 ? static_cast<double>(execs) / seconds : 0.0);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+  options opts = parse(argc, argv);
+  auto start = std::chrono::steady_clock::now();
+
+  if (!opts.files.empty()) {
+    for (const char* path : opts.files) {
+      std::ifstream file(path, std::ios::binary);
+      if (!file) {
+        std::fprintf(stderr, "cannot open %s\n", path);
+        return 1;
+      }
+      std::vector<std::uint8_t> input((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+      LLVMFuzzerTestOneInput(input.data(), input.size());
+    }
+    report(opts.files.size(), std::chrono::steady_clock::now() - start);
+    return 0;
+  }
+
+  std::signal(SIGABRT, save_current_input);
+  std::mt19937_64 rng(opts.seed);
+  std::uniform_int_distribution<std::size_t> length(0, opts.max_len);
+  std::vector<std::uint8_t> input(opts.max_len);
+  auto deadline = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                              std::chrono::duration<double>(opts.max_total_time));
+  std::uint64_t execs = 0;
+  // The clock is read every 256 runs only, so that it doesn't show up in the throughput.
+  while (opts.runs == 0 ? (execs % 256 != 0 || std::chrono::steady_clock::now() < deadline) : execs < opts.runs) {
+    std::size_t size = length(rng);
+    for (std::size_t i = 0; i < size; i += sizeof(std::uint64_t)) {
+      std::uint64_t word = rng();
+      std::memcpy(input.data() + i, &word, std::min(sizeof(word), size - i));
+    }
+    current_input = input.data();
+    current_size = size;
+    LLVMFuzzerTestOneInput(input.data(), size);
+    ++execs;
+  }
+  report(execs, std::chrono::steady_clock::now() - start);
+}
@@ -0,0 +1,239 @@
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Counts teardowns scheduled by `async_deleter` that haven't finished yet. Once the owners of every
+// object are gone, `wait()` or `co_await group.all_released()` lets shutdown proceed only after
+// the last of those teardowns has completed. The group must outlive every deleter bound to it.
+class release_group {
+public:
+  release_group() = default;
+
+  release_group(const release_group&) = delete;
+  release_group& operator=(const release_group&) = delete;
+
+  std::size_t pending() const {
+    std::lock_guard lock(mutex);
+    return count;
+  }
+
+  void wait() const {
+    std::unique_lock lock(mutex);
+    released.wait(lock, [this] { return count == 0; });
+  }
+
+  class awaiter {
+  public:
+    explicit awaiter(release_group& group) noexcept : group(&group) {}
+
+    bool await_ready() const noexcept {
+      return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> handle) {
+      std::lock_guard lock(group->mutex);
+      if (group->count == 0) {
+        return false;
+      }
+      group->waiters.push_back(handle);
+      return true;
+    }
+
+    void await_resume() const noexcept {}
+
+  private:
+    release_group* group;
+  };
+
+  // Suspended coroutines are resumed on the thread that finishes the last teardown.
+  awaiter all_released() noexcept {
+    return awaiter(*this);
+  }
+
+private:
+  template <typename T, typename Executor, typename Deleter>
+  friend class async_deleter;
+
+  // The counter is only touched under the mutex: whoever observes zero may destroy the group right
+  // away, so the thread bringing it to zero must be done with the group by then.
+  void enter() {
+    std::lock_guard lock(mutex);
+    ++count;
+  }
+
+  void leave() {
+    std::vector<std::coroutine_handle<>> ready;
+    {
+      std::lock_guard lock(mutex);
+      if (--count != 0) {
+        return;
+      }
+      ready.swap(waiters);
+      released.notify_all();
+    }
+    for (auto handle : ready) {
+      handle.resume();
+    }
+  }
+
+private:
+  mutable std::mutex mutex;
+  mutable std::condition_variable released;
+  std::size_t count{0};
+  std::vector<std::coroutine_handle<>> waiters;
+};
+
+// A deleter that runs `Deleter` on an executor instead of inside the destructor of the last owner.
+// `Executor` is anything with an `execute(f)` member taking a nullary callable, which it must
+// eventually invoke exactly once. If scheduling throws, or the executor drops the task without
+// invoking it, the teardown runs synchronously instead.
+//
+//   shared_ptr<segment, async_deleter<segment, thread_pool>> p(new segment(...), {pool, group});
+template <typename T, typename Executor, typename Deleter = std::default_delete<T>>
+class async_deleter {
+public:
+  explicit async_deleter(Executor& executor, Deleter deleter = Deleter())
+      : executor(&executor), deleter(std::move(deleter)) {}
+
+  async_deleter(Executor& executor, release_group& group, Deleter deleter = Deleter())
+      : executor(&executor), group(&group), deleter(std::move(deleter)) {}
+
+  void operator()(T* ptr) {
+    if (group) {
+      group->enter();
+    }
+    try {
+      executor->execute(teardown(std::move(deleter), ptr, group));
+    } catch (...) {
+      // Whichever copy of the task the executor was holding has run it while being destroyed.
+    }
+  }
+
+private:
+  // Owns the object until it runs. Copies hand that ownership over like moves do, so that
+  // executors storing tasks in a `std::function` work, and only the last holder can run it.
+  struct teardown {
+    teardown(Deleter deleter, T* ptr, release_group* group) noexcept
+        : deleter(std::move(deleter)), ptr(ptr), group(group) {}
+
+    teardown(const teardown& other)
+        : deleter(other.deleter), ptr(other.ptr), group(other.group), armed(std::exchange(other.armed, false)) {}
+
+    teardown(teardown&& other) noexcept
+        : deleter(std::move(other.deleter)), ptr(other.ptr), group(other.group),
+          armed(std::exchange(other.armed, false)) {}
+
+    teardown& operator=(const teardown&) = delete;
+    teardown& operator=(teardown&&) = delete;
+
+    ~teardown() {
+      run();
+    }
+
+    void operator()() {
+      run();
+    }
+
+    void run() noexcept {
+      if (!std::exchange(armed, false)) {
+        return;
+      }
+      deleter(ptr);
+      if (group) {
+        group->leave();
+      }
+    }
+
+    [[no_unique_address]] Deleter deleter;
+    T* ptr;
+    release_group* group;
+    mutable bool armed{true};
+  };
+
+  Executor* executor;
+  release_group* group{nullptr};
+  [[no_unique_address]] Deleter deleter;
+};
+
+namespace detail {
+
+struct detached_task {
+  struct promise_type {
+    detached_task get_return_object() noexcept {
+      return {};
+    }
+
+    std::suspend_never initial_suspend() noexcept {
+      return {};
+    }
+
+    std::suspend_never final_suspend() noexcept {
+      return {};
+    }
+
+    void return_void() noexcept {}
+
+    // Only the task itself can get here, on a scheduler thread that has nobody to report to.
+    void unhandled_exception() noexcept {
+      std::terminate();
+    }
+  };
+};
+
+} // namespace detail
+
+// Adapts a coroutine scheduler, anything whose `schedule()` returns an awaitable that resumes the
+// awaiting coroutine on one of its threads, to the executor interface of `async_deleter`. If
+// `schedule()` or suspending on its result throws, so does `execute`; the task is then either left
+// to the caller or destroyed without being invoked. Resuming must not throw.
+template <typename Scheduler>
+class scheduler_executor {
+public:
+  explicit scheduler_executor(Scheduler& scheduler) noexcept : scheduler(&scheduler) {}
+
+  template <typename F>
+  void execute(F&& f) {
+    std::exception_ptr error;
+    run<std::remove_reference_t<F>>(scheduler->schedule(), f, error);
+    if (error) {
+      std::rethrow_exception(error);
+    }
+  }
+
+private:
+// GCC emits spurious -Wzero-as-null-pointer-constant for the generated coroutine frame code.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wzero-as-null-pointer-constant"
+#endif
+
+  // Takes `f` by reference and moves it only once the coroutine frame exists, so a failed frame
+  // allocation leaves `f` to the caller. A failure to suspend is handed back through `error`
+  // rather than to the promise, which could neither report it nor free the frame.
+  template <typename F, typename Awaitable>
+  static detail::detached_task run(Awaitable awaitable, F& f, std::exception_ptr& error) {
+    F task = std::move(f);
+    try {
+      co_await std::move(awaitable);
+    } catch (...) {
+      error = std::current_exception();
+      co_return;
+    }
+    task();
+  }
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+private:
+  Scheduler* scheduler;
+};
@@ -0,0 +1,385 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A pointer to an object in the same mapping, stored as the distance from the pointer itself.
+// Mappings of one segment land at different addresses in different processes; offsets stay valid
+// in all of them as long as both ends are in the segment. Use it for pointers between parts of an
+// object shared through `interprocess_shared_ptr`.
+template <typename T>
+class offset_ptr {
+public:
+  offset_ptr() noexcept = default;
+
+  offset_ptr(std::nullptr_t) noexcept {}
+
+  offset_ptr(T* ptr) noexcept {
+    set(ptr);
+  }
+
+  offset_ptr(const offset_ptr& other) noexcept {
+    set(other.get());
+  }
+
+  offset_ptr& operator=(const offset_ptr& other) noexcept {
+    set(other.get());
+    return *this;
+  }
+
+  offset_ptr& operator=(T* ptr) noexcept {
+    set(ptr);
+    return *this;
+  }
+
+  T* get() const noexcept {
+    if (offset == null_offset) {
+      return nullptr;
+    }
+    return reinterpret_cast<T*>(reinterpret_cast<std::uintptr_t>(this) + static_cast<std::uintptr_t>(offset));
+  }
+
+  explicit operator bool() const noexcept {
+    return offset != null_offset;
+  }
+
+  T& operator*() const noexcept {
+    return *get();
+  }
+
+  T* operator->() const noexcept {
+    return get();
+  }
+
+  friend bool operator==(const offset_ptr& lhs, const offset_ptr& rhs) noexcept {
+    return lhs.get() == rhs.get();
+  }
+
+  friend bool operator!=(const offset_ptr& lhs, const offset_ptr& rhs) noexcept {
+    return !(lhs == rhs);
+  }
+
+private:
+  // A pointer never points one byte past itself, so that distance is free to mean null.
+  static constexpr std::ptrdiff_t null_offset = 1;
+
+  void set(T* ptr) noexcept {
+    offset = ptr ? static_cast<std::ptrdiff_t>(reinterpret_cast<std::uintptr_t>(ptr) -
+                                               reinterpret_cast<std::uintptr_t>(this))
+                 : null_offset;
+  }
+
+  std::ptrdiff_t offset{null_offset};
+};
+
+namespace detail {
+
+static_assert(std::atomic<std::size_t>::is_always_lock_free,
+              "counters shared between processes must not fall back to a process-local lock");
+
+// The start of every segment. Zero-filled memory reads as a segment with no mappings, which is
+// what another process sees until the creator has finished constructing the object.
+struct segment_header {
+  // Enough for any name `shm_open` accepts on Linux, the terminating null included.
+  static constexpr std::size_t name_capacity = 256;
+
+  // Mappings of the segment held by `interprocess_shared_ptr`s, normally one per process.
+  std::atomic<std::size_t> mappings;
+  std::uint64_t type_tag;
+  offset_ptr<std::byte> object;
+  // The name the segment was created under, empty for anonymous ones. Kept in the segment so that
+  // the last process unlinks it however it got there, by name or by descriptor.
+  char name[name_capacity];
+};
+
+// Cheap check that every process maps the segment as the same type.
+template <typename T>
+std::uint64_t type_tag() noexcept {
+  std::uint64_t hash = 14695981039346656037ull;
+  for (const char* c = typeid(T).name(); *c; ++c) {
+    hash = (hash ^ static_cast<unsigned char>(*c)) * 1099511628211ull;
+  }
+  return hash ^ (sizeof(T) << 32) ^ alignof(T);
+}
+
+template <typename T>
+constexpr std::size_t object_offset() noexcept {
+  return (sizeof(segment_header) + alignof(T) - 1) / alignof(T) * alignof(T);
+}
+
+[[noreturn]] inline void throw_errno(const char* what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+// One mapping of a segment in this process, shared by every handle made from it. Copies within the
+// process only touch this process-local count; the count in the segment changes once per mapping.
+struct segment_mapping {
+  explicit segment_mapping(int fd) : fd(fd) {
+    struct stat status {};
+    if (fstat(fd, &status) != 0) {
+      throw_errno("fstat");
+    }
+    size = static_cast<std::size_t>(status.st_size);
+    if (size < sizeof(segment_header)) {
+      throw std::runtime_error("interprocess_shared_ptr: not a segment");
+    }
+    void* address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (address == MAP_FAILED) {
+      throw_errno("mmap");
+    }
+    header = static_cast<segment_header*>(address);
+  }
+
+  segment_mapping(const segment_mapping&) = delete;
+  segment_mapping& operator=(const segment_mapping&) = delete;
+
+  ~segment_mapping() {
+    munmap(header, size);
+    close(fd);
+  }
+
+  std::atomic<std::size_t> handles{1};
+  int fd;
+  std::size_t size{0};
+  segment_header* header{nullptr};
+};
+
+} // namespace detail
+
+// Shared ownership of an object living in a POSIX shared memory segment, across processes. Within a
+// process it behaves like `shared_ptr`. The last handle in a process unmaps the segment, and the
+// last process to do so destroys the object and unlinks the segment name.
+//
+//   // producer
+//   auto data = interprocess_shared_ptr<dataset>::create("/dataset-v3", args...);
+//   // consumers
+//   auto data = interprocess_shared_ptr<dataset>::open("/dataset-v3");
+//
+// `T` must be usable from any process that maps it: it can't hold process-local pointers, file
+// descriptors or heap allocations; use `offset_ptr` for pointers within the object. Vtable
+// pointers are process-local too, which is what the checks below enforce: `T` must have standard
+// layout, which rules out virtual functions and virtual bases. A process that dies while holding
+// the segment leaves it alive, as a file would.
+//
+// After `fork()`, the child must neither use nor destroy handles inherited from the parent: it
+// shares their process-local state by copy only. It should `open()` the segment again instead.
+template <typename T>
+class interprocess_shared_ptr {
+  static_assert(!std::is_polymorphic_v<T>,
+                "the vtable pointer of a polymorphic object is only valid in the process that wrote it");
+  static_assert(std::is_standard_layout_v<T>,
+                "objects shared between processes must have standard layout: no virtual bases or functions");
+
+public:
+  interprocess_shared_ptr() noexcept = default;
+
+  interprocess_shared_ptr(std::nullptr_t) noexcept {}
+
+  ~interprocess_shared_ptr() {
+    release();
+  }
+
+  interprocess_shared_ptr(const interprocess_shared_ptr& other) noexcept : ptr(other.ptr), mapping(other.mapping) {
+    if (mapping) {
+      mapping->handles.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  interprocess_shared_ptr(interprocess_shared_ptr&& other) noexcept
+      : ptr(std::exchange(other.ptr, nullptr)), mapping(std::exchange(other.mapping, nullptr)) {}
+
+  interprocess_shared_ptr& operator=(const interprocess_shared_ptr& other) noexcept {
+    interprocess_shared_ptr(other).swap(*this);
+    return *this;
+  }
+
+  interprocess_shared_ptr& operator=(interprocess_shared_ptr&& other) noexcept {
+    interprocess_shared_ptr(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  // Creates the segment `name` (as for `shm_open`, "/name") and the object in it. Fails if a
+  // segment of that name exists already.
+  template <typename... Args>
+  static interprocess_shared_ptr create(const char* name, Args&&... args) {
+    if (std::strlen(name) >= detail::segment_header::name_capacity) {
+      throw std::system_error(std::make_error_code(std::errc::filename_too_long), "shm_open");
+    }
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+      detail::throw_errno("shm_open");
+    }
+    try {
+      return construct(fd, name, std::forward<Args>(args)...);
+    } catch (...) {
+      shm_unlink(name);
+      throw;
+    }
+  }
+
+  // Creates the object in an anonymous segment. Other processes get to it through `fd()`, by
+  // inheriting or receiving the descriptor and passing it to `open(int)`.
+  template <typename... Args>
+  static interprocess_shared_ptr create_anonymous(Args&&... args) {
+#ifdef __linux__
+    int fd = memfd_create("interprocess_shared_ptr", MFD_CLOEXEC);
+    if (fd < 0) {
+      detail::throw_errno("memfd_create");
+    }
+    return construct(fd, "", std::forward<Args>(args)...);
+#else
+    static_cast<void>(sizeof...(args));
+    throw std::system_error(std::make_error_code(std::errc::function_not_supported), "memfd_create");
+#endif
+  }
+
+  // Joins the segment `name`. Fails if there is no such segment, if it holds another type, or if
+  // its last process has already released it.
+  static interprocess_shared_ptr open(const char* name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+      detail::throw_errno("shm_open");
+    }
+    return attach(fd);
+  }
+
+  // Joins the segment behind `fd`. The descriptor is duplicated and stays the caller's.
+  static interprocess_shared_ptr open(int fd) {
+    int own_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    if (own_fd < 0) {
+      detail::throw_errno("fcntl");
+    }
+    return attach(own_fd);
+  }
+
+  T* get() const noexcept {
+    return ptr;
+  }
+
+  explicit operator bool() const noexcept {
+    return get() != nullptr;
+  }
+
+  T& operator*() const noexcept {
+    return *get();
+  }
+
+  T* operator->() const noexcept {
+    return get();
+  }
+
+  // Handles sharing the object in this process.
+  std::size_t use_count() const noexcept {
+    return mapping ? mapping->handles.load(std::memory_order_relaxed) : 0;
+  }
+
+  // Mappings of the segment in all processes, normally one per process.
+  std::size_t mapping_count() const noexcept {
+    return mapping ? mapping->header->mappings.load(std::memory_order_relaxed) : 0;
+  }
+
+  // The descriptor of the segment, valid as long as this handle owns it.
+  int fd() const noexcept {
+    return mapping ? mapping->fd : -1;
+  }
+
+  void reset() noexcept {
+    interprocess_shared_ptr().swap(*this);
+  }
+
+  friend bool operator==(const interprocess_shared_ptr& lhs, const interprocess_shared_ptr& rhs) noexcept {
+    return lhs.get() == rhs.get();
+  }
+
+  friend bool operator!=(const interprocess_shared_ptr& lhs, const interprocess_shared_ptr& rhs) noexcept {
+    return !(lhs == rhs);
+  }
+
+private:
+  interprocess_shared_ptr(T* ptr, detail::segment_mapping* mapping) noexcept : ptr(ptr), mapping(mapping) {}
+
+  // Sizes the new segment behind `fd`, constructs the object and only then publishes the segment
+  // by setting its mapping count, so that nobody can join a half-built one.
+  template <typename... Args>
+  static interprocess_shared_ptr construct(int fd, const char* name, Args&&... args) {
+    std::size_t size = detail::object_offset<T>() + sizeof(T);
+    if (ftruncate(fd, static_cast<off_t>(size)) != 0) {
+      int error = errno;
+      close(fd);
+      throw std::system_error(error, std::generic_category(), "ftruncate");
+    }
+    auto mapping = map(fd);
+    auto* header = ::new (static_cast<void*>(mapping->header)) detail::segment_header();
+    auto* object = reinterpret_cast<unsigned char*>(header) + detail::object_offset<T>();
+    T* ptr = ::new (static_cast<void*>(object)) T(std::forward<Args>(args)...);
+    header->type_tag = detail::type_tag<T>();
+    std::strcpy(header->name, name);
+    header->object = reinterpret_cast<std::byte*>(ptr);
+    header->mappings.store(1, std::memory_order_release);
+    return interprocess_shared_ptr(ptr, mapping.release());
+  }
+
+  static interprocess_shared_ptr attach(int fd) {
+    auto mapping = map(fd);
+    detail::segment_header* header = mapping->header;
+    std::size_t mappings = header->mappings.load(std::memory_order_acquire);
+    // The rest of the header is written before the count is published and never changes after.
+    if (mappings != 0 &&
+        (header->type_tag != detail::type_tag<T>() || mapping->size < detail::object_offset<T>() + sizeof(T))) {
+      throw std::runtime_error("interprocess_shared_ptr: segment holds another type");
+    }
+    do {
+      if (mappings == 0) {
+        throw std::runtime_error("interprocess_shared_ptr: segment is not ready or already released");
+      }
+    } while (!header->mappings.compare_exchange_weak(mappings, mappings + 1, std::memory_order_acquire));
+    T* ptr = reinterpret_cast<T*>(header->object.get());
+    return interprocess_shared_ptr(ptr, mapping.release());
+  }
+
+  static std::unique_ptr<detail::segment_mapping> map(int fd) {
+    try {
+      return std::make_unique<detail::segment_mapping>(fd);
+    } catch (...) {
+      close(fd);
+      throw;
+    }
+  }
+
+  void swap(interprocess_shared_ptr& other) noexcept {
+    std::swap(ptr, other.ptr);
+    std::swap(mapping, other.mapping);
+  }
+
+  void release() noexcept {
+    if (!mapping || mapping->handles.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+      return;
+    }
+    if (mapping->header->mappings.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::destroy_at(ptr);
+      if (mapping->header->name[0] != '\0') {
+        shm_unlink(mapping->header->name);
+      }
+    }
+    delete mapping;
+  }
+
+private:
+  T* ptr{nullptr};
+  detail::segment_mapping* mapping{nullptr};
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "linked-ptr.h"
+
+#include <cstddef>
+#include <type_traits>
+
+// A non-owning view of an object owned by `linked_ptr`s. Unlike a copy of a `linked_ptr` it doesn't
+// join the ring, so creating and dropping one writes to no neighbour node. It's up to the caller
+// to keep an owner alive while the observer is used.
+//
+// In release builds an observer is a plain pointer. With SMART_PTR_CHECKED_OBSERVERS (the default
+// unless NDEBUG is defined) dereferencing it after the last owner has released the object reports
+// the dangling observer and aborts.
+//
+// The check finds the object by address. For classes without virtual functions that address is
+// the one the handle holds, so the observer and the last owner must agree on it: if they point to
+// different bases of an object with multiple inheritance, the release goes unnoticed, and an
+// object later allocated at the observer's address can make a dangling observer look valid.
+// Polymorphic objects are found by their most derived address and have no such limit.
+template <typename T>
+class linked_observer {
+  template <typename Y>
+  using enable_if_convertible_from = std::enable_if_t<std::is_convertible_v<Y*, T*>>;
+
+public:
+  linked_observer() noexcept = default;
+
+  linked_observer(std::nullptr_t) noexcept {}
+
+  template <typename Y, typename D, typename = enable_if_convertible_from<Y>>
+  linked_observer(const linked_ptr<Y, D>& owner) : ptr(owner.get()) {
+#if SMART_PTR_CHECKED_OBSERVERS
+    if (ptr) {
+      identity = detail::object_identity(ptr);
+      generation = detail::observer_registry::instance().watch(identity);
+    }
+#endif
+  }
+
+  template <typename Y, typename = enable_if_convertible_from<Y>>
+  linked_observer(const linked_observer<Y>& other) noexcept : ptr(other.ptr) {
+#if SMART_PTR_CHECKED_OBSERVERS
+    identity = other.identity;
+    generation = other.generation;
+#endif
+  }
+
+  T* get() const noexcept {
+    check();
+    return ptr;
+  }
+
+  explicit operator bool() const noexcept {
+    return ptr != nullptr;
+  }
+
+  T& operator*() const noexcept {
+    return *get();
+  }
+
+  T* operator->() const noexcept {
+    return get();
+  }
+
+  friend bool operator==(const linked_observer& lhs, const linked_observer& rhs) noexcept {
+    return lhs.ptr == rhs.ptr;
+  }
+
+  friend bool operator!=(const linked_observer& lhs, const linked_observer& rhs) noexcept {
+    return !(lhs == rhs);
+  }
+
+private:
+  template <typename Y>
+  friend class linked_observer;
+
+  void check() const noexcept {
+#if SMART_PTR_CHECKED_OBSERVERS
+    if (ptr && !detail::observer_registry::instance().is_alive(identity, generation)) {
+      std::fprintf(stderr, "linked_observer used after the last owner released the object\n");
+      std::abort();
+    }
+#endif
+  }
+
+private:
+  T* ptr{nullptr};
+#if SMART_PTR_CHECKED_OBSERVERS
+  // Taken while the object was known to be alive: finding it again must not touch the object.
+  const void* identity{nullptr};
+  std::uint64_t generation{0};
+#endif
+};
@@ -1,50 +1,403 @@
 #pragma once
 
+#include "ownership-profiler.h"
+
 #include <cstddef>
 #include <memory>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+// Checked `linked_observer`s notice use after the last owner has released the object, at the cost
+// of a registry lookup per access. They are on unless NDEBUG is defined; every translation unit of
+// a program must agree on the setting.
+#ifndef SMART_PTR_CHECKED_OBSERVERS
+#ifdef NDEBUG
+#define SMART_PTR_CHECKED_OBSERVERS 0
+#else
+#define SMART_PTR_CHECKED_OBSERVERS 1
+#endif
+#endif
+
+#if SMART_PTR_CHECKED_OBSERVERS
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+#endif
+
+enum class ring_layout {
+  // Every node knows both neighbours: copies, resets and destruction are O(1).
+  doubly_linked,
+  // Every node knows only its successor, saving a pointer per `linked_ptr`. Leaving a ring walks it
+  // to find the predecessor, so releasing an owner is O(ring size) instead of O(1).
+  singly_linked,
+};
+
+// Chooses the ring layout of `linked_ptr<T, ...>`. Pointers can only be converted between types
+// with the same layout, so specialize it for a whole class hierarchy at once:
+//
+//   template <>
+//   struct ring_layout_traits<graph_node> {
+//     static constexpr ring_layout value = ring_layout::singly_linked;
+//   };
+template <typename T>
+struct ring_layout_traits {
+  static constexpr ring_layout value = ring_layout::doubly_linked;
+};
+
+namespace detail {
+
+// A node of the ring joining every `linked_ptr` that shares one object. Nodes that own nothing are
+// not linked at all, a sole owner is linked to itself.
+template <ring_layout Layout>
+class ring_node;
+
+template <>
+class ring_node<ring_layout::doubly_linked> {
+public:
+  ring_node() noexcept = default;
+
+  ring_node(const ring_node&) = delete;
+  ring_node& operator=(const ring_node&) = delete;
+
+  bool is_linked() const noexcept {
+    return next != nullptr;
+  }
+
+  bool is_alone() const noexcept {
+    return next == this;
+  }
+
+  void link_alone() noexcept {
+    prev = next = this;
+  }
+
+  void link_after(const ring_node& pos) noexcept {
+    prev = &pos;
+    next = pos.next;
+    pos.next = this;
+    next->prev = this;
+  }
+
+  void unlink() noexcept {
+    if (is_linked()) {
+      prev->next = next;
+      next->prev = prev;
+      prev = next = nullptr;
+    }
+  }
+
+  const ring_node* successor() const noexcept {
+    return next;
+  }
+
+private:
+  mutable const ring_node* prev{nullptr};
+  mutable const ring_node* next{nullptr};
+};
+
+template <>
+class ring_node<ring_layout::singly_linked> {
+public:
+  ring_node() noexcept = default;
+
+  ring_node(const ring_node&) = delete;
+  ring_node& operator=(const ring_node&) = delete;
+
+  bool is_linked() const noexcept {
+    return next != nullptr;
+  }
+
+  bool is_alone() const noexcept {
+    return next == this;
+  }
+
+  void link_alone() noexcept {
+    next = this;
+  }
+
+  void link_after(const ring_node& pos) noexcept {
+    next = pos.next;
+    pos.next = this;
+  }
+
+  void unlink() noexcept {
+    if (is_linked()) {
+      predecessor()->next = next;
+      next = nullptr;
+    }
+  }
+
+  const ring_node* successor() const noexcept {
+    return next;
+  }
+
+private:
+  // Recovers the back pointer the layout doesn't store. Must not be called on an unlinked node or
+  // on a node that is alone in its ring.
+  const ring_node* predecessor() const noexcept {
+    const ring_node* node = next;
+    while (node->next != this) {
+      node = node->next;
+    }
+    return node;
+  }
+
+private:
+  mutable const ring_node* next{nullptr};
+};
+
+#if SMART_PTR_CHECKED_OBSERVERS
+
+// Objects that checked observers look at, each with the generation it had when the first of them
+// was created. Objects leave the registry when their last owner lets go of them, so an observer
+// whose object is missing, or present with another generation because its address was reused, is
+// dangling. Nothing is allocated or locked unless observers exist.
+class observer_registry {
+public:
+  static observer_registry& instance() {
+    static observer_registry registry;
+    return registry;
+  }
+
+  // Lets owners skip the registry, including the construction guard of `instance()`, while no
+  // object is watched.
+  static bool any_watched() noexcept {
+    return watched.load(std::memory_order_relaxed) != 0;
+  }
+
+  std::uint64_t watch(const void* object) {
+    std::lock_guard lock(mutex);
+    auto [it, inserted] = generations.try_emplace(object, next_generation);
+    if (inserted) {
+      ++next_generation;
+      watched.store(generations.size(), std::memory_order_relaxed);
+    }
+    return it->second;
+  }
+
+  bool is_alive(const void* object, std::uint64_t generation) const {
+    std::lock_guard lock(mutex);
+    auto it = generations.find(object);
+    return it != generations.end() && it->second == generation;
+  }
+
+  void forget(const void* object) noexcept {
+    std::lock_guard lock(mutex);
+    generations.erase(object);
+    watched.store(generations.size(), std::memory_order_relaxed);
+  }
+
+private:
+  mutable std::mutex mutex;
+  std::unordered_map<const void*, std::uint64_t> generations;
+  std::uint64_t next_generation{1};
+  // Constant-initialized, so reading it needs no guard.
+  static inline std::atomic<std::size_t> watched{0};
+};
+
+// Handles of different classes in one ring may point to different subobjects. Polymorphic objects
+// are identified by their most derived address, so that any of them finds the registry entry.
+// Other objects are identified by the address the handle holds: an observer and the last owner
+// that see the object through bases at different offsets (multiple inheritance) don't agree on
+// it, see `linked_observer`.
+template <typename T>
+const void* object_identity(T* ptr) noexcept {
+  if constexpr (std::is_polymorphic_v<T>) {
+    return dynamic_cast<const void*>(ptr);
+  } else {
+    return ptr;
+  }
+}
+
+#endif
+
+// Called by the last owner of `ptr` right before it lets go of the object.
+template <typename T>
+void forget_observed([[maybe_unused]] T* ptr) noexcept {
+#if SMART_PTR_CHECKED_OBSERVERS
+  if (observer_registry::any_watched()) {
+    observer_registry::instance().forget(object_identity(ptr));
+  }
+#endif
+}
+
+template <ring_layout Layout>
+std::size_t ring_size(const ring_node<Layout>& node) noexcept {
+  if (!node.is_linked()) {
+    return 0;
+  }
+  std::size_t size = 1;
+  for (const ring_node<Layout>* current = node.successor(); current != &node; current = current->successor()) {
+    ++size;
+  }
+  return size;
+}
+
+} // namespace detail
 
 template <typename T, typename Deleter = std::default_delete<T>>
 class linked_ptr {
+  static constexpr ring_layout layout = ring_layout_traits<std::remove_cv_t<T>>::value;
+
+  template <typename Y, typename D>
+  using enable_if_convertible_from =
+      std::enable_if_t<std::is_convertible_v<Y*, T*> && std::is_constructible_v<Deleter, const D&> &&
+                       ring_layout_traits<std::remove_cv_t<Y>>::value == layout>;
+
 public:
-  linked_ptr() noexcept;
+  linked_ptr() noexcept = default;
 
-  ~linked_ptr();
+  ~linked_ptr() {
+    release();
+  }
 
-  linked_ptr(std::nullptr_t) noexcept;
+  linked_ptr(std::nullptr_t) noexcept {}
 
-  explicit linked_ptr(T* ptr);
+  explicit linked_ptr(T* ptr) : ptr(ptr) {
+    node.link_alone();
+  }
 
-  linked_ptr(T* ptr, Deleter deleter);
+  linked_ptr(T* ptr, Deleter deleter) : ptr(ptr), deleter(std::move(deleter)) {
+    node.link_alone();
+  }
 
-  linked_ptr(const linked_ptr& other) noexcept;
+  linked_ptr(const linked_ptr& other) noexcept : ptr(other.ptr), deleter(other.deleter) {
+    if (other.node.is_linked()) {
+      node.link_after(other.node);
+      detail::profile_copy<T>([this] { return use_count(); });
+    }
+  }
 
-  template <typename Y, typename D>
-  linked_ptr(const linked_ptr<Y, D>& other) noexcept;
+  template <typename Y, typename D, typename = enable_if_convertible_from<Y, D>>
+  linked_ptr(const linked_ptr<Y, D>& other) noexcept : ptr(other.ptr), deleter(other.deleter) {
+    if (other.node.is_linked()) {
+      node.link_after(other.node);
+      detail::profile_copy<T>([this] { return use_count(); });
+    }
+  }
 
-  linked_ptr& operator=(const linked_ptr& other) noexcept;
+  linked_ptr& operator=(const linked_ptr& other) noexcept {
+    if (this != &other) {
+      assign_from(other);
+    }
+    return *this;
+  }
 
-  template <typename Y, typename D>
-  linked_ptr& operator=(const linked_ptr<Y, D>& other) noexcept;
+  template <typename Y, typename D, typename = enable_if_convertible_from<Y, D>>
+  linked_ptr& operator=(const linked_ptr<Y, D>& other) noexcept {
+    assign_from(other);
+    return *this;
+  }
+
+  T* get() const noexcept {
+    return ptr;
+  }
 
-  T* get() const noexcept;
+  explicit operator bool() const noexcept {
+    return get() != nullptr;
+  }
 
-  explicit operator bool() const noexcept;
+  T& operator*() const noexcept {
+    return *get();
+  }
 
-  T& operator*() const noexcept;
+  T* operator->() const noexcept {
+    return get();
+  }
 
-  T* operator->() const noexcept;
+  std::size_t use_count() const noexcept {
+    return detail::ring_size(node);
+  }
 
-  std::size_t use_count() const noexcept;
+  bool unique() const noexcept {
+    return node.is_alone();
+  }
 
-  void reset() noexcept;
+  // If this is the sole owner, gives the object and its deleter up to the caller without destroying
+  // either, leaving this pointer empty. Otherwise returns nothing and stays in the ring.
+  std::optional<std::unique_ptr<T, Deleter>> try_release_unique() {
+    if (!unique()) {
+      return std::nullopt;
+    }
+    detail::forget_observed(ptr);
+    std::optional<std::unique_ptr<T, Deleter>> result(std::in_place, ptr, std::move(deleter));
+    node.unlink();
+    ptr = nullptr;
+    return result;
+  }
 
-  void reset(T* new_ptr);
+  void reset() noexcept {
+    release();
+    ptr = nullptr;
+  }
 
-  void reset(T* new_ptr, Deleter deleter);
+  void reset(T* new_ptr) {
+    Deleter new_deleter;
+    assign(new_ptr, new_deleter, [](auto& self) { self.link_alone(); });
+  }
+
+  void reset(T* new_ptr, Deleter deleter) {
+    assign(new_ptr, deleter, [](auto& self) { self.link_alone(); });
+  }
+
+  friend bool operator==(const linked_ptr& lhs, const linked_ptr& rhs) noexcept {
+    return lhs.get() == rhs.get();
+  }
+
+  friend bool operator!=(const linked_ptr& lhs, const linked_ptr& rhs) noexcept {
+    return !(lhs == rhs);
+  }
+
+private:
+  template <typename Y, typename D>
+  friend class linked_ptr;
+
+  template <typename Y, typename D>
+  void assign_from(const linked_ptr<Y, D>& other) noexcept {
+    Deleter new_deleter(other.deleter);
+    // `other` may be gone once `assign` returns, see below.
+    bool shares = other.node.is_linked();
+    assign(other.ptr, new_deleter, [&other](auto& self) {
+      if (other.node.is_linked()) {
+        self.link_after(other.node);
+      }
+    });
+    if (shares) {
+      detail::profile_copy<T>([this] { return use_count(); });
+    }
+  }
 
-  friend bool operator==(const linked_ptr& lhs, const linked_ptr& rhs) noexcept;
+  // Leaves the current ring, takes `new_ptr` and `new_deleter` over and lets `link` join the new
+  // ring. The previous object is destroyed only afterwards, so its destruction may release the
+  // source of the assignment. On return `new_deleter` holds the previous deleter.
+  template <typename Link>
+  void assign(T* new_ptr, Deleter& new_deleter, Link link) noexcept {
+    T* old_ptr = std::exchange(ptr, new_ptr);
+    bool last_owner = node.is_alone();
+    node.unlink();
+    using std::swap;
+    swap(deleter, new_deleter);
+    link(node);
+    if (last_owner) {
+      detail::forget_observed(old_ptr);
+      new_deleter(old_ptr);
+    }
+  }
 
-  friend bool operator!=(const linked_ptr& lhs, const linked_ptr& rhs) noexcept;
+  void release() noexcept {
+    if (node.is_alone()) {
+      detail::forget_observed(ptr);
+      deleter(ptr);
+    }
+    node.unlink();
+  }
 
 private:
+  T* ptr{nullptr};
+  detail::ring_node<layout> node;
+  [[no_unique_address]] Deleter deleter;
 };
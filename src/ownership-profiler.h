@@ -0,0 +1,249 @@
+#pragma once
+
+// A sampling profiler for reference count traffic. Defining SMART_PTR_OWNERSHIP_PROFILER (the
+// ENABLE_OWNERSHIP_PROFILER CMake option) compiles its hooks into the copy and assignment paths of
+// `shared_ptr` and `linked_ptr`; without it they are empty and the functions below do nothing.
+//
+//   ownership_profiler::start(1000);  // about one sample per 1000 copies, on every thread
+//   run_workload();
+//   ownership_profiler::stop();
+//   ownership_profiler::dump("ownership.folded");  // flamegraph.pl ownership.folded > ownership.svg
+//
+// A sample is the call stack of a copy, the managed type and the number of owners right after it:
+// `use_count()` of a `shared_ptr`, the ring size of a `linked_ptr`. The dump has one folded stack
+// per line, outermost frame first, followed by the type and a power-of-two bucket of the owner
+// count, weighted by the estimated number of copies. Executables need -rdynamic for the frames to
+// be named instead of only addressed.
+//
+// With the hooks compiled in but sampling stopped, a copy pays one thread-local decrement and a
+// branch that is almost never taken.
+
+#include <cstddef>
+
+#ifdef SMART_PTR_OWNERSHIP_PROFILER
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <typeindex>
+#include <typeinfo>
+#include <vector>
+
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define SMART_PTR_PROFILER_HAS_BACKTRACE 1
+#endif
+
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#define SMART_PTR_PROFILER_HAS_DEMANGLE 1
+#endif
+
+namespace detail::profiler {
+
+// While sampling is stopped, threads look at `period` again only after this many copies, which
+// bounds how long they take to notice `start()`.
+inline constexpr std::size_t idle_interval = std::size_t{1} << 16;
+inline constexpr int max_depth = 48;
+
+inline std::atomic<std::size_t> period{0};
+
+// Copies left before this thread takes its next sample or rechecks `period`. Constant-initialized,
+// so accessing it needs no guard.
+inline thread_local std::size_t countdown = 1;
+inline thread_local std::uint32_t jitter_state = 0x9e3779b9u;
+
+struct sample_key {
+  std::vector<void*> frames;
+  std::type_index type;
+  std::size_t owners_bucket;
+
+  friend bool operator<(const sample_key& lhs, const sample_key& rhs) noexcept {
+    return std::tie(lhs.frames, lhs.type, lhs.owners_bucket) < std::tie(rhs.frames, rhs.type, rhs.owners_bucket);
+  }
+};
+
+struct sample_table {
+  std::mutex mutex;
+  std::map<sample_key, std::size_t> weights;
+};
+
+inline sample_table& samples() {
+  static sample_table table;
+  return table;
+}
+
+// The next countdown, uniform in [1, 2 * current - 1] so that the mean stays at `current` while
+// loops with a period of their own can't line up with the samples.
+inline std::size_t next_countdown(std::size_t current) noexcept {
+  if (current <= 1) {
+    return 1;
+  }
+  jitter_state ^= jitter_state << 13;
+  jitter_state ^= jitter_state >> 17;
+  jitter_state ^= jitter_state << 5;
+  return 1 + jitter_state % (2 * current - 1);
+}
+
+// Refills the countdown and tells whether the copy that ran it out is to be sampled.
+inline bool tick() noexcept {
+  std::size_t current = period.load(std::memory_order_relaxed);
+  countdown = current ? next_countdown(current) : idle_interval;
+  return current != 0;
+}
+
+inline std::size_t bucket(std::size_t owners) noexcept {
+  std::size_t result = 1;
+  while (result <= owners / 2) {
+    result *= 2;
+  }
+  return result;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((noinline))
+#endif
+inline void record(const std::type_info& type, std::size_t owners) noexcept {
+  std::size_t weight = period.load(std::memory_order_relaxed);
+  if (weight == 0) {
+    return;
+  }
+  try {
+    std::vector<void*> frames;
+#ifdef SMART_PTR_PROFILER_HAS_BACKTRACE
+    void* buffer[max_depth];
+    int depth = backtrace(buffer, max_depth);
+    // The first frame is this function.
+    frames.assign(buffer + std::min(depth, 1), buffer + depth);
+#endif
+    sample_key key{std::move(frames), std::type_index(type), bucket(owners)};
+    std::lock_guard lock(samples().mutex);
+    samples().weights[std::move(key)] += weight;
+  } catch (...) {
+    // Out of memory: drop the sample rather than the program.
+  }
+}
+
+inline std::string demangle(const char* name) {
+#ifdef SMART_PTR_PROFILER_HAS_DEMANGLE
+  int status = 0;
+  char* demangled = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+  if (status == 0 && demangled) {
+    std::string result(demangled);
+    std::free(demangled);
+    return result;
+  }
+#endif
+  return name;
+}
+
+// Turns "path/module(mangled+0x1f) [0x4005d6]" into the demangled function name. Frames without a
+// known symbol become "module+0x1f", which unlike the address doesn't change from run to run.
+inline std::string frame_name(const char* symbol) {
+  std::string text(symbol);
+  std::size_t open = text.find('(');
+  std::size_t close = text.find(')', open);
+  if (open == std::string::npos || close == std::string::npos) {
+    return text;
+  }
+  std::size_t plus = text.find('+', open);
+  if (plus != std::string::npos && plus > open + 1 && plus < close) {
+    return demangle(text.substr(open + 1, plus - open - 1).c_str());
+  }
+  std::size_t slash = text.rfind('/', open);
+  std::size_t module = slash == std::string::npos ? 0 : slash + 1;
+  return text.substr(module, open - module) + text.substr(open + 1, close - open - 1);
+}
+
+} // namespace detail::profiler
+
+#endif
+
+namespace detail {
+
+// Called by owning handles of `T` after a copy or an assignment made them share an object.
+// `owners` computes the number of owners, and is only called when the copy is sampled.
+template <typename T, typename Owners>
+void profile_copy([[maybe_unused]] const Owners& owners) noexcept {
+#ifdef SMART_PTR_OWNERSHIP_PROFILER
+  if (--profiler::countdown == 0) [[unlikely]] {
+    if (profiler::tick()) {
+      profiler::record(typeid(T), owners());
+    }
+  }
+#endif
+}
+
+} // namespace detail
+
+namespace ownership_profiler {
+
+// Samples about one in `period` copies from now on. The calling thread starts right away, other
+// threads may take a few thousand more copies to notice.
+inline void start([[maybe_unused]] std::size_t period) noexcept {
+#ifdef SMART_PTR_OWNERSHIP_PROFILER
+  detail::profiler::period.store(period, std::memory_order_relaxed);
+  detail::profiler::countdown = 1;
+#endif
+}
+
+inline void stop() noexcept {
+#ifdef SMART_PTR_OWNERSHIP_PROFILER
+  detail::profiler::period.store(0, std::memory_order_relaxed);
+#endif
+}
+
+// Forgets every sample taken so far.
+inline void clear() {
+#ifdef SMART_PTR_OWNERSHIP_PROFILER
+  auto& samples = detail::profiler::samples();
+  std::lock_guard lock(samples.mutex);
+  samples.weights.clear();
+#endif
+}
+
+// Writes the samples to `path` in folded-stack format. Returns false if the hooks aren't compiled
+// in or the file can't be written.
+inline bool dump([[maybe_unused]] const char* path) {
+#ifdef SMART_PTR_OWNERSHIP_PROFILER
+  std::FILE* file = std::fopen(path, "w");
+  if (!file) {
+    return false;
+  }
+  auto& samples = detail::profiler::samples();
+  std::lock_guard lock(samples.mutex);
+  std::map<void*, std::string> names;
+  for (const auto& [key, weight] : samples.weights) {
+    std::string line;
+#ifdef SMART_PTR_PROFILER_HAS_BACKTRACE
+    for (auto it = key.frames.rbegin(); it != key.frames.rend(); ++it) {
+      auto [name, inserted] = names.try_emplace(*it);
+      if (inserted) {
+        char** symbols = backtrace_symbols(&*it, 1);
+        name->second = symbols ? detail::profiler::frame_name(symbols[0]) : "??";
+        std::free(symbols);
+      }
+      line += name->second;
+      line += ';';
+    }
+#endif
+    line += detail::profiler::demangle(key.type.name());
+    line += ";owners " + std::to_string(key.owners_bucket);
+    if (key.owners_bucket > 1) {
+      line += '-' + std::to_string(2 * key.owners_bucket - 1);
+    }
+    std::fprintf(file, "%s %zu\n", line.c_str(), weight);
+  }
+  return std::fclose(file) == 0;
+#else
+  return false;
+#endif
+}
+
+} // namespace ownership_profiler
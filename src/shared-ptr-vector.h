@@ -0,0 +1,102 @@
+#pragma once
+
+#include "shared-ptr.h"
+
+#include <cstddef>
+#include <span>
+#include <utility>
+#include <vector>
+
+// A sequence of `shared_ptr` handles whose bulk operations go through `retain_all` and
+// `release_all`: appending many copies of one object or clearing a vector full of duplicates costs
+// one atomic operation per distinct object rather than one per handle.
+template <typename T, typename Deleter = std::default_delete<T>>
+class shared_ptr_vector {
+public:
+  using value_type = shared_ptr<T, Deleter>;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+  shared_ptr_vector() noexcept = default;
+
+  ~shared_ptr_vector() {
+    clear();
+  }
+
+  shared_ptr_vector(const shared_ptr_vector& other) {
+    append(other.handles);
+  }
+
+  shared_ptr_vector& operator=(const shared_ptr_vector& other) {
+    if (this != &other) {
+      shared_ptr_vector(other).swap(*this);
+    }
+    return *this;
+  }
+
+  // Moves hand the handles over without touching any counter.
+  shared_ptr_vector(shared_ptr_vector&& other) noexcept = default;
+
+  shared_ptr_vector& operator=(shared_ptr_vector&& other) noexcept {
+    shared_ptr_vector(std::move(other)).swap(*this);
+    return *this;
+  }
+
+  std::size_t size() const noexcept {
+    return handles.size();
+  }
+
+  bool empty() const noexcept {
+    return handles.empty();
+  }
+
+  const value_type& operator[](std::size_t index) const noexcept {
+    return handles[index];
+  }
+
+  const_iterator begin() const noexcept {
+    return handles.begin();
+  }
+
+  const_iterator end() const noexcept {
+    return handles.end();
+  }
+
+  void reserve(std::size_t capacity) {
+    handles.reserve(capacity);
+  }
+
+  void push_back(const value_type& handle) {
+    handles.push_back(handle);
+  }
+
+  void pop_back() noexcept {
+    handles.pop_back();
+  }
+
+  // Appends `count` copies of `handle`, which may be an element of this vector.
+  void append(value_type handle, std::size_t count) {
+    std::size_t old_size = handles.size();
+    handles.resize(old_size + count);
+    retain_all(handle, std::span<value_type>(handles).subspan(old_size));
+  }
+
+  // Appends copies of every handle in `source`, which must not refer into this vector.
+  void append(std::span<const value_type> source) {
+    std::size_t old_size = handles.size();
+    handles.resize(old_size + source.size());
+    retain_all(source, std::span<value_type>(handles).subspan(old_size));
+  }
+
+  void clear() noexcept {
+    release_all(std::span<value_type>(handles));
+    handles.clear();
+  }
+
+private:
+  void swap(shared_ptr_vector& other) noexcept {
+    handles.swap(other.handles);
+  }
+
+private:
+  std::vector<value_type> handles;
+};
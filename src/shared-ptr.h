@@ -1,44 +1,565 @@
 #pragma once
 
+#include "ownership-profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <iterator>
 #include <memory>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <span>
+#include <utility>
+
+enum class control_block_layout {
+  // Counters are packed as tightly as the deleter allows.
+  packed,
+  // Every control block owns whole cache lines, so copies of unrelated objects made from different
+  // cores never contend for the same line.
+  cache_aligned,
+};
+
+// Chooses the control block layout of `shared_ptr<T, ...>`. Specialize it for types whose ownership
+// is hot on several threads at once:
+//
+//   template <>
+//   struct control_block_layout_traits<connection> {
+//     static constexpr control_block_layout value = control_block_layout::cache_aligned;
+//   };
+template <typename T>
+struct control_block_layout_traits {
+  static constexpr control_block_layout value = control_block_layout::packed;
+};
+
+namespace detail {
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winterference-size"
+#endif
+
+#ifdef __cpp_lib_hardware_interference_size
+inline constexpr std::size_t destructive_interference_size = std::hardware_destructive_interference_size;
+#else
+inline constexpr std::size_t destructive_interference_size = 64;
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+template <control_block_layout Layout>
+inline constexpr std::size_t counter_alignment = Layout == control_block_layout::cache_aligned
+                                                   ? destructive_interference_size
+                                                   : alignof(std::atomic<std::size_t>);
+
+// The control block is specialized on the deleter type instead of erasing it: there is no vtable
+// pointer, the deleter call is a direct (and usually inlined) call, and an empty deleter takes no
+// space. With `std::default_delete` of a trivially destructible type the whole teardown is one
+// deallocation.
+//
+// Blocks that hold the object themselves or come from a memory resource extend this one, see
+// `inplace_block` and `resource_block`. Which of them a block is gets recorded in the top bits of
+// the counter, so the common heap-allocated block doesn't grow and still needs no virtual call.
+template <typename Deleter, control_block_layout Layout>
+struct control_block {
+  static constexpr std::size_t inplace_flag = ~(~std::size_t{0} >> 1);
+  static constexpr std::size_t resource_flag = inplace_flag >> 1;
+  static constexpr std::size_t count_mask = resource_flag - 1;
+
+  template <typename... Args>
+  explicit control_block(Args&&... args) : deleter(std::forward<Args>(args)...) {}
+
+  template <typename T>
+  void destroy(T* ptr) noexcept {
+    deleter(ptr);
+  }
+
+  std::size_t use_count(std::memory_order order = std::memory_order_relaxed) const noexcept {
+    return strong_count.load(order) & count_mask;
+  }
+
+  alignas(counter_alignment<Layout>) std::atomic<std::size_t> strong_count{1};
+  [[no_unique_address]] Deleter deleter;
+
+protected:
+  // Only called by constructors of derived blocks, before the block is shared.
+  void add_flag(std::size_t flag) noexcept {
+    strong_count.store(strong_count.load(std::memory_order_relaxed) | flag, std::memory_order_relaxed);
+  }
+};
+
+// A block followed by storage for the object itself, as created by `make_shared`: one allocation
+// instead of two, and the object sits next to its counter.
+template <typename T, typename Base>
+struct inplace_block : Base {
+  template <typename... Args>
+  explicit inplace_block(Args&&... args) : Base(std::forward<Args>(args)...) {
+    this->add_flag(Base::inplace_flag);
+  }
+
+  T* object() noexcept {
+    return std::launder(reinterpret_cast<T*>(storage));
+  }
+
+  // Aligned like the block as well, so that with the cache-aligned layout the object doesn't move
+  // into the tail padding of the counter's line.
+  alignas(T) alignas(Base) unsigned char storage[sizeof(T)];
+};
+
+// A block allocated from a memory resource, which has to be remembered to give the block back.
+template <typename Base>
+struct resource_block : Base {
+  template <typename... Args>
+  explicit resource_block(std::pmr::memory_resource* resource, Args&&... args)
+      : Base(std::forward<Args>(args)...), resource(resource) {
+    this->add_flag(Base::resource_flag);
+  }
+
+  std::pmr::memory_resource* resource;
+};
+
+// Allocates a `Block` from `resource` and constructs it with `resource` followed by `args`.
+template <typename Block, typename... Args>
+Block* allocate_block(std::pmr::memory_resource* resource, Args&&... args) {
+  void* memory = resource->allocate(sizeof(Block), alignof(Block));
+  try {
+    return ::new (memory) Block(resource, std::forward<Args>(args)...);
+  } catch (...) {
+    resource->deallocate(memory, sizeof(Block), alignof(Block));
+    throw;
+  }
+}
+
+// `free_block` picks the block type from the counter, which GCC can't see through: it warns that a
+// plain 8-byte block might be accessed as a larger one.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Warray-bounds"
+#endif
+
+template <typename Block>
+void deallocate_block(Block* block) noexcept {
+  std::pmr::memory_resource* resource = block->resource;
+  block->~Block();
+  resource->deallocate(block, sizeof(Block), alignof(Block));
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// Frees a block created by `make_shared`, `allocate_shared` or with a memory resource. Out of line
+// so that releasing a plain heap block stays a decrement and the deleter call.
+template <typename T, typename ControlBlock>
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((noinline, cold))
+#endif
+void free_special_block(ControlBlock* cb, std::size_t flags) noexcept {
+  switch (flags) {
+  case ControlBlock::inplace_flag:
+    delete static_cast<inplace_block<T, ControlBlock>*>(cb);
+    break;
+  case ControlBlock::resource_flag:
+    deallocate_block(static_cast<resource_block<ControlBlock>*>(cb));
+    break;
+  default:
+    deallocate_block(static_cast<inplace_block<T, resource_block<ControlBlock>>*>(cb));
+    break;
+  }
+}
+
+// Frees `cb` without touching the object it manages. `T` is the object type of the owning
+// `shared_ptr`: `make_shared` creates no conversions, so it's also the type of an in-place object.
+template <typename T, typename ControlBlock>
+void free_block(ControlBlock* cb, std::size_t flags) noexcept {
+  if (flags == 0) [[likely]] {
+    delete cb;
+  } else {
+    free_special_block<T>(cb, flags);
+  }
+}
+
+// Tears down the object and a block that isn't a plain heap block.
+template <typename T, typename ControlBlock>
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((noinline, cold))
+#endif
+void destroy_special(ControlBlock* cb, T* ptr, std::size_t flags) noexcept {
+  if (flags & ControlBlock::inplace_flag) {
+    std::destroy_at(ptr);
+  } else {
+    cb->destroy(ptr);
+  }
+  free_special_block<T>(cb, flags);
+}
+
+// Drops `count` references. A plain heap block has no flags, so its last release sees exactly
+// `count` and takes the inlined path.
+template <typename T, typename ControlBlock>
+void release_strong(ControlBlock* cb, T* ptr, std::size_t count) noexcept {
+  std::size_t old_count = cb->strong_count.fetch_sub(count, std::memory_order_acq_rel);
+  if (old_count == count) [[likely]] {
+    cb->destroy(ptr);
+    delete cb;
+  } else if ((old_count & ControlBlock::count_mask) == count) {
+    destroy_special<T>(cb, ptr, old_count - count);
+  }
+}
+
+enum class count_direction {
+  retain,
+  release,
+};
+
+// Groups reference count changes by control block, so that all handles to one object within a
+// chunk cost a single atomic add or sub. A chunk holds up to `chunk` distinct objects, found
+// through a small hash index; a span with no more objects than that is applied with one operation
+// per object. Chunks live on the stack: bulk operations never allocate.
+//
+// When chunks keep filling up with (almost) no duplicates, the lookups buy nothing and the batch
+// applies changes handle by handle for a while before it tries grouping again.
+template <typename T, typename ControlBlock, count_direction Direction>
+class count_batch {
+public:
+  count_batch() noexcept = default;
+
+  count_batch(const count_batch&) = delete;
+  count_batch& operator=(const count_batch&) = delete;
+
+  ~count_batch() {
+    flush();
+  }
+
+  void add(T* ptr, ControlBlock* cb) noexcept {
+    if (!cb) {
+      return;
+    }
+    if (direct_left != 0) {
+      --direct_left;
+      apply({ptr, cb, 1});
+      return;
+    }
+    ++handles;
+    if (size != 0 && entries[size - 1].cb == cb) {
+      ++entries[size - 1].count;
+      return;
+    }
+    std::size_t slot = slot_of(cb);
+    for (; index[slot] != 0; slot = (slot + 1) % slots) {
+      entry& e = entries[index[slot] - 1];
+      if (e.cb == cb) {
+        ++e.count;
+        return;
+      }
+    }
+    if (size == chunk) {
+      flush();
+      handles = 1;
+      slot = slot_of(cb);
+    }
+    entries[size++] = {ptr, cb, 1};
+    index[slot] = static_cast<unsigned char>(size);
+  }
+
+private:
+  struct entry {
+    T* ptr;
+    ControlBlock* cb;
+    std::size_t count;
+  };
+
+  // Fibonacci hashing of the block address, whose low bits are always zero.
+  static std::size_t slot_of(ControlBlock* cb) noexcept {
+    auto bits = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(cb) >> 4);
+    return static_cast<std::size_t>((bits * 0x9e3779b97f4a7c15u) >> (64 - slot_bits));
+  }
+
+  static void apply(const entry& e) noexcept {
+    if constexpr (Direction == count_direction::retain) {
+      e.cb->strong_count.fetch_add(e.count, std::memory_order_relaxed);
+    } else {
+      release_strong(e.cb, e.ptr, e.count);
+    }
+  }
+
+  void flush() noexcept {
+    // The chunk is full and fewer than one handle in eight found its object already there.
+    if (size == chunk && (handles - 1) * 7 < size * 8) {
+      if (++misses == max_misses) {
+        // One more miss right after the direct run is enough to start the next one.
+        misses = max_misses - 1;
+        direct_left = direct_run;
+      }
+    } else {
+      misses = 0;
+    }
+    for (std::size_t i = 0; i < size; ++i) {
+      apply(entries[i]);
+    }
+    size = 0;
+    std::fill(std::begin(index), std::end(index), 0);
+  }
+
+  static constexpr std::size_t chunk = 32;
+  // Kept at most half full, so that probe sequences stay short.
+  static constexpr std::size_t slot_bits = 6;
+  static constexpr std::size_t slots = std::size_t{1} << slot_bits;
+  static constexpr std::size_t max_misses = 2;
+  static constexpr std::size_t direct_run = 32 * chunk;
+
+  entry entries[chunk];
+  // For every slot, one past the index of the entry stored there, or 0 if there's none.
+  unsigned char index[slots]{};
+  std::size_t size{0};
+  // Handles added since the chunk was last flushed, including the one that overflowed it.
+  std::size_t handles{0};
+  std::size_t misses{0};
+  std::size_t direct_left{0};
+};
+
+} // namespace detail
 
 template <typename T, typename Deleter = std::default_delete<T>>
 class shared_ptr {
+  using control_block =
+      detail::control_block<Deleter, control_block_layout_traits<std::remove_cv_t<T>>::value>;
+
 public:
-  shared_ptr() noexcept;
+  shared_ptr() noexcept = default;
+
+  ~shared_ptr() {
+    release();
+  }
 
-  ~shared_ptr();
+  shared_ptr(std::nullptr_t) noexcept {}
 
-  shared_ptr(std::nullptr_t) noexcept;
+  explicit shared_ptr(T* ptr) : ptr(ptr) {
+    try {
+      cb = new control_block();
+    } catch (...) {
+      Deleter()(ptr);
+      throw;
+    }
+  }
 
-  explicit shared_ptr(T* ptr);
+  shared_ptr(T* ptr, Deleter deleter) : ptr(ptr) {
+    try {
+      cb = new control_block(std::move(deleter));
+    } catch (...) {
+      deleter(ptr);
+      throw;
+    }
+  }
 
-  shared_ptr(T* ptr, Deleter deleter);
+  // Allocates the control block from `resource` instead of the global heap. The object itself is
+  // allocated by the caller and destroyed by `deleter` as usual; `resource` must outlive the block.
+  shared_ptr(T* ptr, Deleter deleter, std::pmr::memory_resource* resource) : ptr(ptr) {
+    try {
+      cb = detail::allocate_block<detail::resource_block<control_block>>(resource, std::move(deleter));
+    } catch (...) {
+      deleter(ptr);
+      throw;
+    }
+  }
 
-  shared_ptr(const shared_ptr& other) noexcept;
+  shared_ptr(const shared_ptr& other) noexcept : ptr(other.ptr), cb(other.cb) {
+    if (cb) {
+      cb->strong_count.fetch_add(1, std::memory_order_relaxed);
+      detail::profile_copy<T>([this] { return use_count(); });
+    }
+  }
 
-  shared_ptr& operator=(const shared_ptr& other) noexcept;
+  shared_ptr(shared_ptr&& other) noexcept : ptr(other.ptr), cb(other.cb) {
+    other.ptr = nullptr;
+    other.cb = nullptr;
+  }
 
-  T* get() const noexcept;
+  shared_ptr& operator=(const shared_ptr& other) noexcept {
+    shared_ptr(other).swap(*this);
+    return *this;
+  }
 
-  explicit operator bool() const noexcept;
+  shared_ptr& operator=(shared_ptr&& other) noexcept {
+    shared_ptr(std::move(other)).swap(*this);
+    return *this;
+  }
 
-  T& operator*() const noexcept;
+  T* get() const noexcept {
+    return ptr;
+  }
 
-  T* operator->() const noexcept;
+  explicit operator bool() const noexcept {
+    return get() != nullptr;
+  }
 
-  std::size_t use_count() const noexcept;
+  T& operator*() const noexcept {
+    return *get();
+  }
 
-  void reset() noexcept;
+  T* operator->() const noexcept {
+    return get();
+  }
 
-  void reset(T* new_ptr);
+  std::size_t use_count() const noexcept {
+    return cb ? cb->use_count() : 0;
+  }
 
-  void reset(T* new_ptr, Deleter deleter);
+  bool unique() const noexcept {
+    return cb && cb->use_count(std::memory_order_acquire) == 1;
+  }
 
-  friend bool operator==(const shared_ptr& lhs, const shared_ptr& rhs) noexcept;
+  // If this is the sole owner, gives the object and its deleter up to the caller without destroying
+  // either, leaving this pointer empty. Otherwise returns nothing and keeps sharing. Objects created
+  // by `make_shared` or `allocate_shared` live inside their control block and are never released.
+  std::optional<std::unique_ptr<T, Deleter>> try_release_unique() {
+    if (!unique()) {
+      return std::nullopt;
+    }
+    std::size_t flags = cb->strong_count.load(std::memory_order_relaxed) & ~control_block::count_mask;
+    if (flags & control_block::inplace_flag) {
+      return std::nullopt;
+    }
+    return release_unique(flags);
+  }
 
-  friend bool operator!=(const shared_ptr& lhs, const shared_ptr& rhs) noexcept;
+  void reset() noexcept {
+    shared_ptr().swap(*this);
+  }
+
+  void reset(T* new_ptr) {
+    shared_ptr(new_ptr).swap(*this);
+  }
+
+  void reset(T* new_ptr, Deleter deleter) {
+    shared_ptr(new_ptr, std::move(deleter)).swap(*this);
+  }
+
+  friend bool operator==(const shared_ptr& lhs, const shared_ptr& rhs) noexcept {
+    return lhs.get() == rhs.get();
+  }
+
+  friend bool operator!=(const shared_ptr& lhs, const shared_ptr& rhs) noexcept {
+    return !(lhs == rhs);
+  }
+
+  // Makes `target[i]` a copy of `source[i]` for every `i`. Handles to one object are retained with
+  // a single atomic add as long as the span refers to few enough objects, the previous values of
+  // `target` are released as by `release_all`. The spans must not overlap. Spans of different sizes
+  // are a precondition violation, caught by an assertion in debug builds.
+  friend void retain_all(std::span<const shared_ptr> source, std::span<shared_ptr> target) noexcept {
+    assert(source.size() == target.size() && "retain_all: spans of different sizes");
+    // Every object that `source` refers to keeps an owner in `source`, so the previous values of
+    // `target` can be released in the same pass without destroying anything that gets retained.
+    detail::count_batch<T, control_block, detail::count_direction::release> released;
+    detail::count_batch<T, control_block, detail::count_direction::retain> retained;
+    for (std::size_t i = 0; i < source.size(); ++i) {
+      released.add(target[i].ptr, target[i].cb);
+      retained.add(source[i].ptr, source[i].cb);
+      target[i].ptr = source[i].ptr;
+      target[i].cb = source[i].cb;
+    }
+  }
+
+  // Makes every handle in `target` a copy of `source` with one atomic add. `source` may itself be
+  // one of the handles in `target`.
+  friend void retain_all(const shared_ptr& source, std::span<shared_ptr> target) noexcept {
+    T* ptr = source.ptr;
+    control_block* cb = source.cb;
+    if (cb) {
+      cb->strong_count.fetch_add(target.size(), std::memory_order_relaxed);
+    }
+    release_all(target);
+    for (auto& handle : target) {
+      handle.ptr = ptr;
+      handle.cb = cb;
+    }
+  }
+
+  // Resets every handle in `handles`, coalescing the decrements like `retain_all` does. Objects
+  // whose last owners were among `handles` are destroyed before the call returns.
+  friend void release_all(std::span<shared_ptr> handles) noexcept {
+    detail::count_batch<T, control_block, detail::count_direction::release> batch;
+    for (auto& handle : handles) {
+      batch.add(handle.ptr, handle.cb);
+      handle.ptr = nullptr;
+      handle.cb = nullptr;
+    }
+  }
+
+private:
+  template <typename U, typename... Args>
+  friend shared_ptr<U> make_shared(Args&&... args);
+
+  template <typename U, typename... Args>
+  friend shared_ptr<U> allocate_shared(std::pmr::polymorphic_allocator<> alloc, Args&&... args);
+
+  // Adopts one reference to `cb`.
+  shared_ptr(T* ptr, control_block* cb) noexcept : ptr(ptr), cb(cb) {}
+
+  void swap(shared_ptr& other) noexcept {
+    std::swap(ptr, other.ptr);
+    std::swap(cb, other.cb);
+  }
+
+  // Out of line: when the caller drops the result, GCC would otherwise relate the object it
+  // deletes to `ptr`, fail to see that this pointer was emptied on that path, and warn about a use
+  // after free in `release()`.
+#if defined(__GNUC__) || defined(__clang__)
+  __attribute__((noinline))
+#endif
+  std::optional<std::unique_ptr<T, Deleter>> release_unique(std::size_t flags) {
+    control_block* block = std::exchange(cb, nullptr);
+    std::optional<std::unique_ptr<T, Deleter>> result(std::in_place, std::exchange(ptr, nullptr),
+                                                      std::move(block->deleter));
+    detail::free_block<T>(block, flags);
+    return result;
+  }
+
+  void release() noexcept {
+    if (cb) {
+      detail::release_strong(cb, ptr, 1);
+    }
+  }
 
 private:
+  T* ptr{nullptr};
+  control_block* cb{nullptr};
 };
+
+// Creates the object and its control block with a single allocation from the global heap.
+template <typename T, typename... Args>
+shared_ptr<T> make_shared(Args&&... args) {
+  using block = detail::inplace_block<T, typename shared_ptr<T>::control_block>;
+  auto* cb = new block();
+  try {
+    ::new (static_cast<void*>(cb->storage)) T(std::forward<Args>(args)...);
+  } catch (...) {
+    delete cb;
+    throw;
+  }
+  return shared_ptr<T>(cb->object(), cb);
+}
+
+// Like `make_shared`, but allocates from the memory resource of `alloc`, which must outlive the
+// object. A `std::pmr::memory_resource*` converts implicitly:
+//
+//   std::pmr::monotonic_buffer_resource arena;
+//   auto p = allocate_shared<request>(&arena, id);
+template <typename T, typename... Args>
+shared_ptr<T> allocate_shared(std::pmr::polymorphic_allocator<> alloc, Args&&... args) {
+  using block = detail::inplace_block<T, detail::resource_block<typename shared_ptr<T>::control_block>>;
+  std::pmr::memory_resource* resource = alloc.resource();
+  auto* cb = detail::allocate_block<block>(resource);
+  try {
+    ::new (static_cast<void*>(cb->storage)) T(std::forward<Args>(args)...);
+  } catch (...) {
+    detail::deallocate_block(cb);
+    throw;
+  }
+  return shared_ptr<T>(cb->object(), cb);
+}
@@ -1,9 +1,18 @@
+#include "footprint-budgets.h"
 #include "linked-ptr.h"
 #include "shared-ptr.h"
 #include "test-classes.h"
+#include "typed-smart-ptr-test.h"
 
 #include <gtest/gtest.h>
 
+#include <memory_resource>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#define HAS_MALLOC_USABLE_SIZE 1
+#endif
+
 #if defined(__has_feature)
 #if __has_feature(address_sanitizer)
 #define DISABLE_ALLOCATION_TESTS 1
@@ -53,6 +62,29 @@ struct fault_injection_allocator {
   }
 };
 
+// Routes a memory resource through the same counters and fault injection as `operator new`, and
+// keeps track of the bytes it has handed out.
+struct fault_injection_resource : std::pmr::memory_resource {
+  size_t outstanding_bytes = 0;
+
+private:
+  void* do_allocate(size_t bytes, [[maybe_unused]] size_t alignment) override {
+    assert(alignment <= alignof(std::max_align_t));
+    void* ptr = fault_injection_allocator<std::byte>().allocate(bytes);
+    outstanding_bytes += bytes;
+    return ptr;
+  }
+
+  void do_deallocate(void* ptr, size_t bytes, size_t) override {
+    outstanding_bytes -= bytes;
+    fault_injection_allocator<std::byte>().deallocate(ptr, bytes);
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+    return this == &other;
+  }
+};
+
 struct fault_injection_context {
   std::vector<size_t, fault_injection_allocator<size_t>> skip_ranges;
   size_t error_index = 0;
@@ -66,6 +98,11 @@ thread_local fault_injection_context* context = nullptr;
 thread_local std::size_t new_calls = 0;
 thread_local std::size_t delete_calls = 0;
 
+// Bytes requested through `operator new`, and the bytes the allocator actually handed out for them,
+// rounding included, where it can tell.
+thread_local std::size_t new_bytes = 0;
+thread_local std::size_t charged_bytes = 0;
+
 void* injected_allocate(size_t count) {
   if (!disabled) {
     ++new_calls;
@@ -77,6 +114,14 @@ void* injected_allocate(size_t count) {
 
   void* ptr = std::malloc(count);
   assert(ptr);
+  if (!disabled) {
+    new_bytes += count;
+#ifdef HAS_MALLOC_USABLE_SIZE
+    charged_bytes += malloc_usable_size(ptr);
+#else
+    charged_bytes += count;
+#endif
+  }
   return ptr;
 }
 
@@ -187,35 +232,13 @@ void operator delete[](void* ptr, std::size_t) noexcept {
 
 namespace {
 template <typename IsShared>
-class allocation_calls_test : public ::testing::Test {
+class allocation_calls_test : public smart_ptr_test<IsShared> {
 protected:
-  template <typename T, typename Deleter = std::default_delete<T>>
-  using smart_ptr = std::conditional_t<IsShared::value, shared_ptr<T, Deleter>, linked_ptr<T, Deleter>>;
   using amount_of_allocations = std::integral_constant<int, (IsShared::value ? 1 : 0) + 1>;
-  test_object::no_new_instances_guard instances_guard;
 };
 
 template <typename IsShared>
-class fault_injection_test : public ::testing::Test {
-protected:
-  template <typename T, typename Deleter = std::default_delete<T>>
-  using smart_ptr = std::conditional_t<IsShared::value, shared_ptr<T, Deleter>, linked_ptr<T, Deleter>>;
-  test_object::no_new_instances_guard instances_guard;
-};
-
-using tested_extents = ::testing::Types<std::false_type, std::true_type>;
-
-class extent_name_generator {
-public:
-  template <typename IsShared>
-  static std::string GetName(int) {
-    if (IsShared::value) {
-      return "shared-ptr";
-    } else {
-      return "linked-ptr";
-    }
-  }
-};
+class fault_injection_test : public smart_ptr_test<IsShared> {};
 
 TYPED_TEST_SUITE(allocation_calls_test, tested_extents, extent_name_generator);
 TYPED_TEST_SUITE(fault_injection_test, tested_extents, extent_name_generator);
@@ -236,6 +259,74 @@ TYPED_TEST(allocation_calls_test, allocations) {
   EXPECT_EQ(delete_calls_after - delete_calls_before, TestFixture::amount_of_allocations::value);
 }
 
+TEST(allocation_calls_test, make_shared) {
+  size_t new_calls_before = new_calls;
+  size_t delete_calls_before = delete_calls;
+  {
+    auto p = make_shared<int>(1337);
+    EXPECT_EQ(1337, *p);
+  }
+  EXPECT_EQ(1, new_calls - new_calls_before);
+  EXPECT_EQ(1, delete_calls - delete_calls_before);
+}
+
+TEST(allocation_calls_test, allocate_shared) {
+  std::pmr::unsynchronized_pool_resource pool;
+  shared_ptr<int> warm_up = allocate_shared<int>(&pool, 0);
+  size_t new_calls_before = new_calls;
+  size_t delete_calls_before = delete_calls;
+  {
+    auto p = allocate_shared<int>(&pool, 1337);
+    auto q = p;
+    EXPECT_EQ(1337, *q);
+    shared_ptr<int> r(new int(42), std::default_delete<int>(), &pool);
+  }
+  EXPECT_EQ(1, new_calls - new_calls_before);
+  EXPECT_EQ(1, delete_calls - delete_calls_before);
+}
+
+namespace {
+
+template <typename Deleter>
+void expect_control_block_within_budget(const char* name, Deleter deleter) {
+  int* ptr = new int(42);
+  size_t new_bytes_before = new_bytes;
+  size_t charged_bytes_before = charged_bytes;
+  shared_ptr<int, Deleter> p(ptr, std::move(deleter));
+  size_t deleter_state = std::is_empty_v<Deleter> ? 0 : sizeof(Deleter);
+  size_t requested = new_bytes - new_bytes_before - deleter_state;
+  size_t charged = charged_bytes - charged_bytes_before - deleter_state;
+
+  ::testing::Test::RecordProperty(std::string(name) + "_requested", static_cast<int>(requested));
+  ::testing::Test::RecordProperty(std::string(name) + "_charged", static_cast<int>(charged));
+  EXPECT_LE(requested, footprint_budget::control_block_requested) << name;
+#ifdef HAS_MALLOC_USABLE_SIZE
+  EXPECT_LE(charged, footprint_budget::control_block_charged) << name;
+#endif
+}
+
+} // namespace
+
+TEST(footprint_test, shared_ptr_control_block) {
+  bool deleted = false;
+  expect_control_block_within_budget("stateless", std::default_delete<int>());
+  expect_control_block_within_budget("tracking_deleter", tracking_deleter<int>(&deleted));
+  expect_control_block_within_budget("large_deleter", large_deleter<int>());
+  EXPECT_TRUE(deleted);
+}
+
+TEST(footprint_test, linked_ptr_allocates_nothing) {
+  size_t new_bytes_before = new_bytes;
+  int* ptr = new int(42);
+  size_t object_bytes = new_bytes - new_bytes_before;
+  {
+    linked_ptr<int, large_deleter<int>> p(ptr);
+    linked_ptr<int, large_deleter<int>> q = p;
+    p.reset();
+  }
+  EXPECT_EQ(object_bytes, new_bytes - new_bytes_before);
+}
+
 TYPED_TEST(fault_injection_test, pointer_ctor) {
   faulty_run([] {
     bool deleted = false;
@@ -306,4 +397,80 @@ TYPED_TEST(fault_injection_test, reset_ptr_with_custom_deleter) {
   });
 }
 
+TEST(fault_injection_test, pointer_ctor_with_resource) {
+  fault_injection_resource resource;
+  faulty_run([&resource] {
+    bool deleted = false;
+    int* ptr = new int(42);
+    try {
+      shared_ptr<int, tracking_deleter<int>> sp(ptr, tracking_deleter<int>(&deleted), &resource);
+    } catch (...) {
+      fault_injection_disable dg;
+      EXPECT_TRUE(deleted);
+      throw;
+    }
+  });
+}
+
+TEST(fault_injection_test, make_shared) {
+  faulty_run([] {
+    bool deleted = false;
+    {
+      auto sp = make_shared<destruction_tracker>(&deleted);
+      auto copy = sp;
+    }
+    fault_injection_disable dg;
+    EXPECT_TRUE(deleted);
+  });
+}
+
+namespace {
+
+// Allocates in its constructor, so that construction of the object can fail after its control
+// block has already been allocated.
+struct allocating_object {
+  allocating_object() : data(new int(42)) {}
+
+  std::unique_ptr<int> data;
+};
+
+struct throwing_object {
+  throwing_object() {
+    throw injected_fault("constructor");
+  }
+};
+
+} // namespace
+
+TEST(fault_injection_test, allocate_shared) {
+  fault_injection_resource resource;
+  faulty_run([&resource] {
+    try {
+      auto sp = allocate_shared<allocating_object>(&resource);
+      auto copy = sp;
+      fault_injection_disable dg;
+      EXPECT_EQ(42, *copy->data);
+    } catch (...) {
+      fault_injection_disable dg;
+      EXPECT_EQ(0, resource.outstanding_bytes);
+      throw;
+    }
+  });
+  EXPECT_EQ(0, resource.outstanding_bytes);
+}
+
+TEST(fault_injection_test, make_shared_throwing_constructor) {
+  size_t new_calls_before = new_calls;
+  size_t delete_calls_before = delete_calls;
+  bool thrown = false;
+  try {
+    make_shared<throwing_object>();
+  } catch (const injected_fault&) {
+    thrown = true;
+  }
+  size_t new_calls_after = new_calls;
+  size_t delete_calls_after = delete_calls;
+  EXPECT_TRUE(thrown);
+  EXPECT_EQ(new_calls_after - new_calls_before, delete_calls_after - delete_calls_before);
+}
 #endif
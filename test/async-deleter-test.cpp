@@ -0,0 +1,371 @@
+#include "async-deleter.h"
+#include "test-classes.h"
+#include "typed-smart-ptr-test.h"
+
+#include <gtest/gtest.h>
+
+#include <coroutine>
+#include <deque>
+#include <functional>
+#include <new>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct manual_executor {
+  template <typename F>
+  void execute(F&& f) {
+    tasks.emplace_back(std::forward<F>(f));
+  }
+
+  void run_all() {
+    while (!tasks.empty()) {
+      auto task = std::move(tasks.front());
+      tasks.pop_front();
+      task();
+    }
+  }
+
+  std::deque<std::function<void()>> tasks;
+};
+
+struct throwing_executor {
+  template <typename F>
+  void execute(F&&) {
+    throw std::bad_alloc();
+  }
+};
+
+// Takes tasks by value, as most thread pools do: the task has been moved out of the deleter by the
+// time scheduling fails.
+struct by_value_throwing_executor {
+  template <typename F>
+  void execute(F) {
+    throw std::bad_alloc();
+  }
+};
+
+struct function_throwing_executor {
+  void execute(std::function<void()>) {
+    throw std::bad_alloc();
+  }
+};
+
+// Keeps a copy of every task and drops the original.
+struct copying_executor {
+  void execute(const std::function<void()>& f) {
+    tasks.push_back(f);
+  }
+
+  std::vector<std::function<void()>> tasks;
+};
+
+struct manual_scheduler {
+  struct schedule_awaiter {
+    bool await_ready() const noexcept {
+      return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle) {
+      scheduler->suspended.push_back(handle);
+    }
+
+    void await_resume() const noexcept {}
+
+    manual_scheduler* scheduler;
+  };
+
+  schedule_awaiter schedule() noexcept {
+    return {this};
+  }
+
+  void run_all() {
+    while (!suspended.empty()) {
+      auto handle = suspended.front();
+      suspended.pop_front();
+      handle.resume();
+    }
+  }
+
+  std::deque<std::coroutine_handle<>> suspended;
+};
+
+struct throwing_scheduler {
+  manual_scheduler::schedule_awaiter schedule() {
+    throw std::bad_alloc();
+  }
+};
+
+// Fails only once the coroutine frame holds the task.
+struct suspend_throwing_scheduler {
+  struct schedule_awaiter {
+    bool await_ready() const noexcept {
+      return false;
+    }
+
+    void await_suspend(std::coroutine_handle<>) {
+      throw std::bad_alloc();
+    }
+
+    void await_resume() const noexcept {}
+  };
+
+  schedule_awaiter schedule() noexcept {
+    return {};
+  }
+};
+
+struct counting_deleter {
+  void operator()(test_object* object) const {
+    ++*calls;
+    delete object;
+  }
+
+  int* calls;
+};
+
+struct flag_task {
+  struct promise_type {
+    flag_task get_return_object() noexcept {
+      return {};
+    }
+
+    std::suspend_never initial_suspend() noexcept {
+      return {};
+    }
+
+    std::suspend_never final_suspend() noexcept {
+      return {};
+    }
+
+    void return_void() noexcept {}
+
+    void unhandled_exception() noexcept {
+      std::terminate();
+    }
+  };
+};
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wzero-as-null-pointer-constant"
+#endif
+
+flag_task set_when_released(release_group& group, bool& flag) {
+  co_await group.all_released();
+  flag = true;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+template <typename IsShared>
+class async_deleter_test : public smart_ptr_test<IsShared> {};
+
+TYPED_TEST_SUITE(async_deleter_test, tested_extents, extent_name_generator);
+
+} // namespace
+
+TYPED_TEST(async_deleter_test, deferred_until_executed) {
+  manual_executor executor;
+  release_group group;
+  bool deleted = false;
+  {
+    using deleter = async_deleter<destruction_tracker, manual_executor>;
+    typename TestFixture::template smart_ptr<destruction_tracker, deleter> p(new destruction_tracker(&deleted),
+                                                                             deleter(executor, group));
+    auto q = p;
+  }
+  EXPECT_FALSE(deleted);
+  EXPECT_EQ(1, group.pending());
+  EXPECT_EQ(1, executor.tasks.size());
+
+  executor.run_all();
+  EXPECT_TRUE(deleted);
+  EXPECT_EQ(0, group.pending());
+}
+
+TYPED_TEST(async_deleter_test, wrapped_deleter) {
+  manual_executor executor;
+  bool deleted = false;
+  {
+    using deleter = async_deleter<test_object, manual_executor, tracking_deleter<test_object>>;
+    typename TestFixture::template smart_ptr<test_object, deleter> p(
+        new test_object(42), deleter(executor, tracking_deleter<test_object>(&deleted)));
+  }
+  EXPECT_FALSE(deleted);
+  executor.run_all();
+  EXPECT_TRUE(deleted);
+}
+
+TYPED_TEST(async_deleter_test, synchronous_fallback) {
+  throwing_executor executor;
+  release_group group;
+  bool deleted = false;
+  {
+    using deleter = async_deleter<destruction_tracker, throwing_executor>;
+    typename TestFixture::template smart_ptr<destruction_tracker, deleter> p(new destruction_tracker(&deleted),
+                                                                             deleter(executor, group));
+  }
+  EXPECT_TRUE(deleted);
+  EXPECT_EQ(0, group.pending());
+}
+
+TYPED_TEST(async_deleter_test, synchronous_fallback_by_value) {
+  by_value_throwing_executor executor;
+  release_group group;
+  bool deleted = false;
+  {
+    using deleter = async_deleter<destruction_tracker, by_value_throwing_executor>;
+    typename TestFixture::template smart_ptr<destruction_tracker, deleter> p(new destruction_tracker(&deleted),
+                                                                             deleter(executor, group));
+  }
+  EXPECT_TRUE(deleted);
+  EXPECT_EQ(0, group.pending());
+  group.wait();
+}
+
+TYPED_TEST(async_deleter_test, synchronous_fallback_std_function) {
+  function_throwing_executor executor;
+  release_group group;
+  bool deleted = false;
+  {
+    using deleter = async_deleter<destruction_tracker, function_throwing_executor>;
+    typename TestFixture::template smart_ptr<destruction_tracker, deleter> p(new destruction_tracker(&deleted),
+                                                                             deleter(executor, group));
+  }
+  EXPECT_TRUE(deleted);
+  EXPECT_EQ(0, group.pending());
+  group.wait();
+}
+
+TYPED_TEST(async_deleter_test, copied_task_runs_once) {
+  copying_executor executor;
+  release_group group;
+  bool deleted = false;
+  {
+    using deleter = async_deleter<destruction_tracker, copying_executor>;
+    typename TestFixture::template smart_ptr<destruction_tracker, deleter> p(new destruction_tracker(&deleted),
+                                                                             deleter(executor, group));
+  }
+  EXPECT_FALSE(deleted);
+  EXPECT_EQ(1, group.pending());
+
+  auto copy = executor.tasks.front();
+  executor.tasks.clear();
+  EXPECT_FALSE(deleted);
+  copy();
+  EXPECT_TRUE(deleted);
+  EXPECT_EQ(0, group.pending());
+}
+
+TYPED_TEST(async_deleter_test, dropped_task_runs_synchronously) {
+  manual_executor executor;
+  release_group group;
+  bool deleted = false;
+  {
+    using deleter = async_deleter<destruction_tracker, manual_executor>;
+    typename TestFixture::template smart_ptr<destruction_tracker, deleter> p(new destruction_tracker(&deleted),
+                                                                             deleter(executor, group));
+  }
+  EXPECT_FALSE(deleted);
+  executor.tasks.clear();
+  EXPECT_TRUE(deleted);
+  EXPECT_EQ(0, group.pending());
+}
+
+TYPED_TEST(async_deleter_test, scheduler_executor) {
+  manual_scheduler scheduler;
+  scheduler_executor<manual_scheduler> executor(scheduler);
+  release_group group;
+  bool deleted = false;
+  {
+    using deleter = async_deleter<destruction_tracker, scheduler_executor<manual_scheduler>>;
+    typename TestFixture::template smart_ptr<destruction_tracker, deleter> p(new destruction_tracker(&deleted),
+                                                                             deleter(executor, group));
+  }
+  EXPECT_FALSE(deleted);
+  EXPECT_EQ(1, scheduler.suspended.size());
+
+  scheduler.run_all();
+  EXPECT_TRUE(deleted);
+  EXPECT_EQ(0, group.pending());
+}
+
+TYPED_TEST(async_deleter_test, scheduler_executor_schedule_fails) {
+  throwing_scheduler scheduler;
+  scheduler_executor<throwing_scheduler> executor(scheduler);
+  release_group group;
+  int calls = 0;
+  {
+    using deleter = async_deleter<test_object, scheduler_executor<throwing_scheduler>, counting_deleter>;
+    typename TestFixture::template smart_ptr<test_object, deleter> p(
+        new test_object(42), deleter(executor, group, counting_deleter{&calls}));
+  }
+  EXPECT_EQ(1, calls);
+  EXPECT_EQ(0, group.pending());
+}
+
+TYPED_TEST(async_deleter_test, scheduler_executor_suspend_fails) {
+  suspend_throwing_scheduler scheduler;
+  scheduler_executor<suspend_throwing_scheduler> executor(scheduler);
+  release_group group;
+  int calls = 0;
+  {
+    using deleter = async_deleter<test_object, scheduler_executor<suspend_throwing_scheduler>, counting_deleter>;
+    typename TestFixture::template smart_ptr<test_object, deleter> p(
+        new test_object(42), deleter(executor, group, counting_deleter{&calls}));
+  }
+  EXPECT_EQ(1, calls);
+  EXPECT_EQ(0, group.pending());
+}
+
+TYPED_TEST(async_deleter_test, await_all_released) {
+  manual_executor executor;
+  release_group group;
+  bool deleted_first = false;
+  bool deleted_second = false;
+  bool released = false;
+  {
+    using deleter = async_deleter<destruction_tracker, manual_executor>;
+    typename TestFixture::template smart_ptr<destruction_tracker, deleter> p(new destruction_tracker(&deleted_first),
+                                                                             deleter(executor, group));
+    typename TestFixture::template smart_ptr<destruction_tracker, deleter> q(
+        new destruction_tracker(&deleted_second), deleter(executor, group));
+  }
+  set_when_released(group, released);
+  EXPECT_FALSE(released);
+
+  auto first = std::move(executor.tasks.front());
+  executor.tasks.pop_front();
+  first();
+  EXPECT_FALSE(released);
+
+  executor.run_all();
+  EXPECT_TRUE(deleted_first);
+  EXPECT_TRUE(deleted_second);
+  EXPECT_TRUE(released);
+}
+
+TEST(release_group_test, await_without_pending) {
+  release_group group;
+  bool released = false;
+  set_when_released(group, released);
+  EXPECT_TRUE(released);
+}
+
+TEST(release_group_test, wait_for_other_thread) {
+  manual_executor executor;
+  release_group group;
+  bool deleted = false;
+  {
+    using deleter = async_deleter<destruction_tracker, manual_executor>;
+    shared_ptr<destruction_tracker, deleter> p(new destruction_tracker(&deleted), deleter(executor, group));
+  }
+  std::thread worker([&executor] { executor.run_all(); });
+  group.wait();
+  EXPECT_TRUE(deleted);
+  worker.join();
+}
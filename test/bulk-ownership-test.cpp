@@ -0,0 +1,248 @@
+#include "shared-ptr-vector.h"
+#include "shared-ptr.h"
+#include "test-classes.h"
+
+#include <gtest/gtest.h>
+
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+class bulk_ownership_test : public ::testing::Test {
+protected:
+  test_object::no_new_instances_guard instances_guard;
+};
+
+} // namespace
+
+TEST_F(bulk_ownership_test, retain_all) {
+  shared_ptr<test_object> a(new test_object(42));
+  shared_ptr<test_object> b(new test_object(43));
+  std::vector<shared_ptr<test_object>> source = {a, a, b, a, b, b, nullptr};
+  std::vector<shared_ptr<test_object>> target(source.size());
+
+  retain_all(source, target);
+
+  EXPECT_EQ(7, a.use_count());
+  EXPECT_EQ(7, b.use_count());
+  for (std::size_t i = 0; i < source.size(); ++i) {
+    EXPECT_TRUE(source[i] == target[i]);
+  }
+  EXPECT_EQ(0, target.back().use_count());
+}
+
+TEST_F(bulk_ownership_test, retain_all_releases_target) {
+  bool deleted_a = false;
+  bool deleted_old = false;
+  bool deleted_kept = false;
+  using tracked_ptr = shared_ptr<test_object, tracking_deleter<test_object>>;
+  tracked_ptr a(new test_object(42), tracking_deleter<test_object>(&deleted_a));
+  tracked_ptr kept(new test_object(43), tracking_deleter<test_object>(&deleted_kept));
+  std::vector<tracked_ptr> source(3, a);
+  std::vector<tracked_ptr> target = {
+      tracked_ptr(new test_object(44), tracking_deleter<test_object>(&deleted_old)), kept, nullptr};
+
+  retain_all(source, target);
+
+  EXPECT_FALSE(deleted_a);
+  EXPECT_TRUE(deleted_old);
+  EXPECT_FALSE(deleted_kept);
+  EXPECT_EQ(1, kept.use_count());
+  EXPECT_EQ(7, a.use_count());
+  EXPECT_EQ(42, *target[2]);
+}
+
+#ifndef NDEBUG
+TEST(bulk_ownership_death_test, retain_all_size_mismatch) {
+  shared_ptr<test_object> a(new test_object(42));
+  std::vector<shared_ptr<test_object>> source(3, a);
+  std::vector<shared_ptr<test_object>> target(2);
+  EXPECT_DEATH(retain_all(source, target), "spans of different sizes");
+}
+#endif
+
+TEST_F(bulk_ownership_test, retain_all_fan_out) {
+  shared_ptr<test_object> a(new test_object(42));
+  std::vector<shared_ptr<test_object>> target(100);
+
+  retain_all(a, target);
+
+  EXPECT_EQ(101, a.use_count());
+  EXPECT_EQ(42, *target[99]);
+}
+
+TEST_F(bulk_ownership_test, retain_all_fan_out_from_target) {
+  std::vector<shared_ptr<test_object>> target(4);
+  target[2].reset(new test_object(42));
+
+  retain_all(target[2], target);
+
+  EXPECT_EQ(4, target[0].use_count());
+  EXPECT_EQ(42, *target[0]);
+}
+
+TEST_F(bulk_ownership_test, release_all) {
+  bool deleted_a = false;
+  bool deleted_b = false;
+  using tracked_ptr = shared_ptr<test_object, tracking_deleter<test_object>>;
+  tracked_ptr a(new test_object(42), tracking_deleter<test_object>(&deleted_a));
+  tracked_ptr b(new test_object(43), tracking_deleter<test_object>(&deleted_b));
+  std::vector<tracked_ptr> handles = {a, b, a, nullptr, b, a};
+  tracked_ptr survivor = b;
+  a.reset();
+  b.reset();
+
+  release_all(handles);
+
+  EXPECT_TRUE(deleted_a);
+  EXPECT_FALSE(deleted_b);
+  EXPECT_EQ(1, survivor.use_count());
+  for (const auto& handle : handles) {
+    EXPECT_FALSE(static_cast<bool>(handle));
+  }
+}
+
+TEST_F(bulk_ownership_test, release_all_many_distinct) {
+  std::vector<shared_ptr<test_object>> objects;
+  for (int i = 0; i < 20; ++i) {
+    objects.emplace_back(new test_object(i));
+  }
+  std::vector<shared_ptr<test_object>> handles;
+  for (int round = 0; round < 3; ++round) {
+    handles.insert(handles.end(), objects.begin(), objects.end());
+  }
+
+  release_all(handles);
+
+  for (const auto& object : objects) {
+    EXPECT_EQ(1, object.use_count());
+  }
+  release_all(objects);
+  instances_guard.expect_no_instances();
+}
+
+TEST_F(bulk_ownership_test, retain_and_release_many_interleaved) {
+  std::vector<shared_ptr<test_object>> objects;
+  for (int i = 0; i < 24; ++i) {
+    objects.emplace_back(new test_object(i));
+  }
+  std::vector<shared_ptr<test_object>> source;
+  for (int round = 0; round < 50; ++round) {
+    source.insert(source.end(), objects.begin(), objects.end());
+  }
+  std::vector<shared_ptr<test_object>> target(source.size());
+
+  retain_all(source, target);
+  for (const auto& object : objects) {
+    EXPECT_EQ(101, object.use_count());
+  }
+  release_all(target);
+  release_all(source);
+  for (const auto& object : objects) {
+    EXPECT_EQ(1, object.use_count());
+  }
+}
+
+TEST_F(bulk_ownership_test, retain_and_release_mostly_distinct) {
+  // Every 100th object appears twice, too rarely for grouping to pay off.
+  std::vector<shared_ptr<test_object>> source;
+  for (int i = 0; i < 5000; ++i) {
+    source.emplace_back(new test_object(i));
+    if (i % 100 == 0) {
+      source.push_back(source.back());
+    }
+  }
+  std::vector<shared_ptr<test_object>> target(source.size());
+
+  retain_all(source, target);
+  for (std::size_t i = 0; i < source.size(); ++i) {
+    ASSERT_TRUE(source[i] == target[i]);
+    EXPECT_EQ(*source[i] % 100 == 0 ? 4 : 2, source[i].use_count());
+  }
+  release_all(source);
+  for (const auto& handle : target) {
+    EXPECT_EQ(*handle % 100 == 0 ? 2 : 1, handle.use_count());
+  }
+  release_all(target);
+  instances_guard.expect_no_instances();
+}
+
+TEST_F(bulk_ownership_test, move) {
+  shared_ptr<test_object> p(new test_object(42));
+  shared_ptr<test_object> q = std::move(p);
+  EXPECT_FALSE(static_cast<bool>(p));
+  EXPECT_EQ(1, q.use_count());
+
+  shared_ptr<test_object> r(new test_object(43));
+  r = std::move(q);
+  EXPECT_FALSE(static_cast<bool>(q));
+  EXPECT_EQ(42, *r);
+  EXPECT_EQ(1, r.use_count());
+}
+
+TEST_F(bulk_ownership_test, vector_append) {
+  shared_ptr<test_object> a(new test_object(42));
+  shared_ptr_vector<test_object> v;
+  v.append(a, 10);
+  v.push_back(a);
+  EXPECT_EQ(11, v.size());
+  EXPECT_EQ(12, a.use_count());
+
+  v.append(v[0], 5);
+  EXPECT_EQ(16, v.size());
+  EXPECT_EQ(17, a.use_count());
+  EXPECT_EQ(42, *v[15]);
+}
+
+TEST_F(bulk_ownership_test, vector_copy_and_clear) {
+  shared_ptr<test_object> a(new test_object(42));
+  shared_ptr<test_object> b(new test_object(43));
+  shared_ptr_vector<test_object> v;
+  v.append(a, 3);
+  v.append(b, 2);
+
+  shared_ptr_vector<test_object> w = v;
+  EXPECT_EQ(5, w.size());
+  EXPECT_EQ(7, a.use_count());
+  EXPECT_EQ(5, b.use_count());
+
+  v.clear();
+  EXPECT_TRUE(v.empty());
+  EXPECT_EQ(4, a.use_count());
+
+  w = v;
+  EXPECT_TRUE(w.empty());
+  EXPECT_EQ(1, a.use_count());
+  EXPECT_EQ(1, b.use_count());
+}
+
+TEST_F(bulk_ownership_test, vector_move) {
+  shared_ptr<test_object> a(new test_object(42));
+  shared_ptr_vector<test_object> v;
+  v.append(a, 3);
+
+  shared_ptr_vector<test_object> w = std::move(v);
+  EXPECT_EQ(3, w.size());
+  EXPECT_EQ(4, a.use_count());
+
+  shared_ptr_vector<test_object> x;
+  x.append(shared_ptr<test_object>(new test_object(43)), 2);
+  x = std::move(w);
+  EXPECT_EQ(3, x.size());
+  EXPECT_EQ(42, *x[0]);
+  EXPECT_EQ(4, a.use_count());
+
+  static_assert(std::is_nothrow_move_constructible_v<shared_ptr_vector<test_object>>);
+  static_assert(std::is_nothrow_move_assignable_v<shared_ptr_vector<test_object>>);
+}
+
+TEST_F(bulk_ownership_test, vector_destroys_last_owners) {
+  bool deleted = false;
+  {
+    shared_ptr_vector<destruction_tracker> v;
+    v.append(shared_ptr<destruction_tracker>(new destruction_tracker(&deleted)), 100);
+    EXPECT_FALSE(deleted);
+  }
+  EXPECT_TRUE(deleted);
+}
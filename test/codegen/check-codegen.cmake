@@ -0,0 +1,36 @@
+# Checks the calls made by the `codegen_*` functions in an assembly file.
+#
+#   cmake -DASSEMBLY=<file.s> -DALLOWED=<regex> -P check-codegen.cmake
+#
+# Every direct call or tail call must go to a symbol matching ALLOWED, and indirect calls and jumps
+# (virtual calls, calls through function pointers, switch jump tables) are not allowed at all.
+
+file(STRINGS "${ASSEMBLY}" lines)
+
+set(function "")
+set(checked 0)
+set(errors "")
+foreach(line IN LISTS lines)
+  if(line MATCHES "^(codegen_[A-Za-z0-9_]+):")
+    set(function "${CMAKE_MATCH_1}")
+    math(EXPR checked "${checked} + 1")
+  elseif(function AND line MATCHES "^[ \t]*\\.size[ \t]+${function},")
+    set(function "")
+  elseif(function AND line MATCHES "^[ \t]*(call|jmp)q?[ \t]+(.*)$")
+    set(instruction "${CMAKE_MATCH_1}")
+    string(REGEX REPLACE "[ \t]*#.*$" "" target "${CMAKE_MATCH_2}")
+    if(target MATCHES "^\\*" OR target MATCHES "^notrack")
+      list(APPEND errors "${function}: indirect ${instruction} ${target}")
+    elseif(NOT target MATCHES "^\\.L" AND NOT target MATCHES "${ALLOWED}")
+      list(APPEND errors "${function}: unexpected ${instruction} to ${target}")
+    endif()
+  endif()
+endforeach()
+
+if(checked EQUAL 0)
+  message(FATAL_ERROR "No codegen_* functions found in ${ASSEMBLY}")
+endif()
+if(errors)
+  list(JOIN errors "\n  " report)
+  message(FATAL_ERROR "Release path of shared_ptr is no longer inlined:\n  ${report}")
+endif()
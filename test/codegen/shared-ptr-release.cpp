@@ -0,0 +1,38 @@
+// Compiled to assembly by the codegen check (see CHECK_CODEGEN in CMakeLists.txt). Each `codegen_*`
+// function releases a `shared_ptr` whose control block is a plain heap block, and the check fails
+// the build if one of them calls anything but `operator delete`, the deleter itself or the cold
+// path for in-place and resource-backed blocks, or makes an indirect call.
+
+#include "shared-ptr.h"
+
+#include <memory>
+
+namespace {
+
+struct point {
+  int x;
+  int y;
+};
+
+} // namespace
+
+// Only declared: the check needs a call that the deleter can't inline away.
+void recycle(int* object) noexcept;
+
+struct recycling_deleter {
+  void operator()(int* object) const noexcept {
+    recycle(object);
+  }
+};
+
+extern "C" void codegen_reset_int(shared_ptr<int>& p) noexcept {
+  p.reset();
+}
+
+extern "C" void codegen_destroy_trivial(shared_ptr<point>* p) noexcept {
+  std::destroy_at(p);
+}
+
+extern "C" void codegen_reset_custom_deleter(shared_ptr<int, recycling_deleter>& p) noexcept {
+  p.reset();
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+
+// Committed memory budgets of the smart pointers. These handles are held by the hundred million, so
+// growing any of them must be a deliberate decision: raise the budget in the same change.
+namespace footprint_budget {
+
+inline constexpr std::size_t pointer = sizeof(void*);
+
+// `sizeof` of a handle with a stateless deleter. Stateful deleters may add their own size on top.
+inline constexpr std::size_t shared_ptr_handle = 2 * pointer;
+inline constexpr std::size_t linked_ptr_handle = 3 * pointer;
+inline constexpr std::size_t compact_linked_ptr_handle = 2 * pointer;
+
+// A `linked_observer` in release builds.
+inline constexpr std::size_t linked_observer = pointer;
+
+// Per-handle cost of the ring itself.
+inline constexpr std::size_t ring_node = 2 * pointer;
+inline constexpr std::size_t compact_ring_node = pointer;
+
+// Bytes a shared_ptr control block requests from the allocator beyond the deleter's own state.
+inline constexpr std::size_t control_block_requested = pointer;
+
+// The same as the allocator hands it out, rounding included, where it reports usable sizes. Per
+// block headers aren't visible that way and are left out. glibc rounds a stateless block up to
+// three pointers.
+inline constexpr std::size_t control_block_charged = 4 * pointer;
+
+} // namespace footprint_budget
@@ -0,0 +1,216 @@
+#include "interprocess-shared-ptr.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <new>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+struct dataset {
+  explicit dataset(int seed) {
+    for (std::size_t i = 0; i < values.size(); ++i) {
+      values[i] = seed + static_cast<int>(i);
+    }
+    middle = &values[values.size() / 2];
+  }
+
+  std::array<int, 1024> values;
+  offset_ptr<int> middle;
+  std::atomic<int> readers{0};
+};
+
+struct other_dataset {
+  int value;
+};
+
+std::string unique_name(const char* test) {
+  return "/smart-ptr-" + std::string(test) + "-" + std::to_string(getpid());
+}
+
+bool segment_exists(const std::string& name) {
+  int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    return false;
+  }
+  close(fd);
+  return true;
+}
+
+// Runs `body` in a child process and returns its exit code. The child never returns into the test
+// and never destroys anything it inherited.
+template <typename F>
+int in_child(F body) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    int code = 1;
+    try {
+      code = body();
+    } catch (...) {
+      code = 2;
+    }
+    _exit(code);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+} // namespace
+
+TEST(offset_ptr_test, survives_relocation) {
+  alignas(offset_ptr<int>) unsigned char first[64];
+  alignas(offset_ptr<int>) unsigned char second[64];
+  auto* target = reinterpret_cast<int*>(first + 32);
+  *target = 42;
+  auto* ptr = new (first) offset_ptr<int>(target);
+  EXPECT_EQ(42, **ptr);
+
+  // Copying the bytes moves both ends by the same distance.
+  std::copy(std::begin(first), std::end(first), std::begin(second));
+  auto* moved = std::launder(reinterpret_cast<offset_ptr<int>*>(second));
+  EXPECT_EQ(reinterpret_cast<int*>(second + 32), moved->get());
+
+  offset_ptr<int> null;
+  EXPECT_FALSE(null);
+  EXPECT_EQ(nullptr, null.get());
+  offset_ptr<int> copy = *ptr;
+  EXPECT_EQ(target, copy.get());
+}
+
+TEST(interprocess_shared_ptr_test, in_process_copies) {
+  auto p = interprocess_shared_ptr<dataset>::create_anonymous(1);
+  EXPECT_EQ(1, p.use_count());
+  EXPECT_EQ(1, p.mapping_count());
+  {
+    auto q = p;
+    EXPECT_EQ(2, p.use_count());
+    EXPECT_EQ(1, p.mapping_count());
+    EXPECT_EQ(p, q);
+  }
+  auto moved = std::move(p);
+  EXPECT_FALSE(p);
+  EXPECT_EQ(1, moved.use_count());
+  EXPECT_EQ(513, *moved->middle);
+}
+
+TEST(interprocess_shared_ptr_test, second_mapping_in_process) {
+  auto p = interprocess_shared_ptr<dataset>::create_anonymous(1);
+  auto q = interprocess_shared_ptr<dataset>::open(p.fd());
+  EXPECT_EQ(2, p.mapping_count());
+  EXPECT_NE(p.get(), q.get());
+  EXPECT_EQ(&q->values[512], q->middle.get());
+
+  p->values[0] = 42;
+  EXPECT_EQ(42, q->values[0]);
+  p.reset();
+  EXPECT_EQ(1, q.mapping_count());
+  EXPECT_EQ(42, q->values[0]);
+}
+
+TEST(interprocess_shared_ptr_test, anonymous_across_fork) {
+  auto p = interprocess_shared_ptr<dataset>::create_anonymous(100);
+  int fd = p.fd();
+  int code = in_child([fd] {
+    auto q = interprocess_shared_ptr<dataset>::open(fd);
+    ++q->readers;
+    return q.mapping_count() == 2 && *q->middle == 612 ? 0 : 3;
+  });
+  EXPECT_EQ(0, code);
+  EXPECT_EQ(1, p->readers.load());
+  EXPECT_EQ(1, p.mapping_count());
+}
+
+TEST(interprocess_shared_ptr_test, last_process_unlinks) {
+  std::string name = unique_name("unlink");
+  auto p = interprocess_shared_ptr<dataset>::create(name.c_str(), 7);
+  EXPECT_TRUE(segment_exists(name));
+
+  int ready[2];
+  int done[2];
+  ASSERT_EQ(0, pipe(ready));
+  ASSERT_EQ(0, pipe(done));
+  pid_t pid = fork();
+  if (pid == 0) {
+    int code = 1;
+    try {
+      auto q = interprocess_shared_ptr<dataset>::open(name.c_str());
+      char c = 0;
+      code = write(ready[1], &c, 1) == 1 && read(done[0], &c, 1) == 1 && q->values[0] == 7 ? 0 : 3;
+    } catch (...) {
+      code = 2;
+    }
+    _exit(code);
+  }
+  char c = 0;
+  ASSERT_EQ(1, read(ready[0], &c, 1));
+  EXPECT_EQ(2, p.mapping_count());
+
+  // The child still holds the segment, so releasing it here keeps the name.
+  p.reset();
+  EXPECT_TRUE(segment_exists(name));
+  ASSERT_EQ(1, write(done[1], &c, 1));
+
+  int status = 0;
+  waitpid(pid, &status, 0);
+  EXPECT_TRUE(WIFEXITED(status));
+  EXPECT_EQ(0, WEXITSTATUS(status));
+  EXPECT_FALSE(segment_exists(name));
+  for (int fd : {ready[0], ready[1], done[0], done[1]}) {
+    close(fd);
+  }
+}
+
+TEST(interprocess_shared_ptr_test, last_release_through_fd_unlinks) {
+  std::string name = unique_name("unlink-fd");
+  auto p = interprocess_shared_ptr<dataset>::create(name.c_str(), 7);
+  auto q = interprocess_shared_ptr<dataset>::open(p.fd());
+  p.reset();
+  EXPECT_TRUE(segment_exists(name));
+  q.reset();
+  EXPECT_FALSE(segment_exists(name));
+
+  auto again = interprocess_shared_ptr<dataset>::create(name.c_str(), 8);
+  EXPECT_EQ(8, again->values[0]);
+}
+
+TEST(interprocess_shared_ptr_test, create_long_name_fails) {
+  std::string name = "/" + std::string(300, 'x');
+  EXPECT_THROW(interprocess_shared_ptr<dataset>::create(name.c_str(), 1), std::system_error);
+}
+
+TEST(interprocess_shared_ptr_test, create_existing_fails) {
+  std::string name = unique_name("existing");
+  auto p = interprocess_shared_ptr<dataset>::create(name.c_str(), 1);
+  EXPECT_THROW(interprocess_shared_ptr<dataset>::create(name.c_str(), 2), std::system_error);
+  EXPECT_EQ(1, p->values[0]);
+}
+
+TEST(interprocess_shared_ptr_test, open_missing_fails) {
+  std::string name = unique_name("missing");
+  EXPECT_THROW(interprocess_shared_ptr<dataset>::open(name.c_str()), std::system_error);
+}
+
+TEST(interprocess_shared_ptr_test, open_other_type_fails) {
+  std::string name = unique_name("other-type");
+  auto p = interprocess_shared_ptr<dataset>::create(name.c_str(), 1);
+  EXPECT_THROW(interprocess_shared_ptr<other_dataset>::open(name.c_str()), std::runtime_error);
+  EXPECT_EQ(1, p.mapping_count());
+}
+
+TEST(interprocess_shared_ptr_test, open_released_fails) {
+  auto p = interprocess_shared_ptr<dataset>::create_anonymous(1);
+  int fd = dup(p.fd());
+  p.reset();
+  EXPECT_THROW(interprocess_shared_ptr<dataset>::open(fd), std::runtime_error);
+  close(fd);
+}
@@ -0,0 +1,135 @@
+#include "footprint-budgets.h"
+#include "linked-observer.h"
+#include "test-classes.h"
+
+#include <gtest/gtest.h>
+
+#include <new>
+
+namespace {
+
+struct polymorphic_base {
+  virtual ~polymorphic_base() = default;
+
+  int value{42};
+};
+
+struct polymorphic_derived : polymorphic_base {};
+
+// Destroys objects without freeing their storage, so that a new object can take the same address.
+template <typename T>
+struct destroy_only_deleter {
+  void operator()(T* object) const {
+    object->~T();
+  }
+};
+
+} // namespace
+
+TEST(linked_observer_test, does_not_join_the_ring) {
+  linked_ptr<test_object> p(new test_object(42));
+  linked_observer<test_object> observer = p;
+  EXPECT_EQ(1, p.use_count());
+  EXPECT_EQ(p.get(), observer.get());
+  EXPECT_EQ(42, *observer);
+}
+
+TEST(linked_observer_test, empty) {
+  linked_observer<test_object> observer;
+  EXPECT_FALSE(observer);
+  EXPECT_EQ(nullptr, observer.get());
+
+  linked_ptr<test_object> p;
+  linked_observer<test_object> from_empty = p;
+  EXPECT_FALSE(from_empty);
+  EXPECT_EQ(observer, from_empty);
+}
+
+TEST(linked_observer_test, outlives_some_owners) {
+  auto* object = new test_object(42);
+  linked_ptr<test_object> p(object);
+  linked_observer<test_object> observer = p;
+  linked_ptr<test_object> q = p;
+  p.reset();
+  EXPECT_EQ(object, observer.get());
+  EXPECT_EQ(42, *observer);
+}
+
+TEST(linked_observer_test, converting) {
+  bool deleted = false;
+  linked_ptr<destruction_tracker, std::default_delete<destruction_tracker_base>> p(new destruction_tracker(&deleted));
+  linked_observer<destruction_tracker> derived = p;
+  linked_observer<destruction_tracker_base> base = derived;
+  linked_observer<destruction_tracker_base> direct = p;
+  EXPECT_EQ(base, direct);
+  EXPECT_EQ(p.get(), base.get());
+  EXPECT_EQ(1, p.use_count());
+}
+
+#if !SMART_PTR_CHECKED_OBSERVERS
+TEST(linked_observer_test, release_build_footprint) {
+  static_assert(sizeof(linked_observer<int>) <= footprint_budget::linked_observer);
+}
+#endif
+
+#if SMART_PTR_CHECKED_OBSERVERS
+
+TEST(linked_observer_test, registry_only_holds_observed_objects) {
+  linked_ptr<test_object> unobserved(new test_object(41));
+  unobserved.reset();
+  EXPECT_FALSE(detail::observer_registry::any_watched());
+
+  linked_ptr<test_object> p(new test_object(42));
+  linked_observer<test_object> observer = p;
+  EXPECT_EQ(42, *observer);
+  EXPECT_TRUE(detail::observer_registry::any_watched());
+  p.reset();
+  EXPECT_FALSE(detail::observer_registry::any_watched());
+}
+
+TEST(linked_observer_death_test, after_last_reset) {
+  linked_ptr<test_object> p(new test_object(42));
+  linked_observer<test_object> observer = p;
+  p.reset();
+  EXPECT_DEATH(observer.get(), "after the last owner");
+}
+
+TEST(linked_observer_death_test, after_last_assignment) {
+  linked_ptr<test_object> p(new test_object(42));
+  linked_ptr<test_object> q(new test_object(43));
+  linked_observer<test_object> observer = p;
+  p = q;
+  EXPECT_DEATH(static_cast<void>(*observer), "after the last owner");
+}
+
+TEST(linked_observer_death_test, after_release) {
+  linked_ptr<test_object> p(new test_object(42));
+  linked_observer<test_object> observer = p;
+  auto released = p.try_release_unique();
+  EXPECT_DEATH(observer.get(), "after the last owner");
+}
+
+TEST(linked_observer_death_test, reused_address) {
+  alignas(test_object) unsigned char storage[sizeof(test_object)];
+  using owner = linked_ptr<test_object, destroy_only_deleter<test_object>>;
+  owner p(new (storage) test_object(42));
+  linked_observer<test_object> stale = p;
+  p.reset();
+
+  owner q(new (storage) test_object(43));
+  linked_observer<test_object> fresh = q;
+  EXPECT_EQ(43, *fresh);
+  EXPECT_DEATH(stale.get(), "after the last owner");
+}
+
+TEST(linked_observer_death_test, polymorphic_through_base) {
+  linked_ptr<polymorphic_derived, std::default_delete<polymorphic_base>> p(new polymorphic_derived);
+  linked_observer<polymorphic_derived> observer = p;
+  linked_ptr<polymorphic_base> base = p;
+  p.reset();
+  EXPECT_EQ(42, observer->value);
+  base.reset();
+  EXPECT_DEATH(observer.get(), "after the last owner");
+}
+
+#endif
@@ -0,0 +1,118 @@
+#include "linked-ptr.h"
+#include "ownership-profiler.h"
+#include "shared-ptr.h"
+
+#include <gtest/gtest.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#ifdef SMART_PTR_OWNERSHIP_PROFILER
+
+namespace {
+
+struct profiled_object {
+  int value;
+};
+
+class profiler_test : public ::testing::Test {
+protected:
+  void SetUp() override {
+    ownership_profiler::clear();
+  }
+
+  void TearDown() override {
+    ownership_profiler::stop();
+    ownership_profiler::clear();
+  }
+
+  // Dumps the samples and returns the lines of the dump.
+  static std::vector<std::string> dump() {
+    std::string path = ::testing::TempDir() + "ownership-profiler-test.folded";
+    EXPECT_TRUE(ownership_profiler::dump(path.c_str()));
+    std::ifstream file(path);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(file, line);) {
+      lines.push_back(line);
+    }
+    return lines;
+  }
+
+  // Sums the weights of the lines that end in `suffix` followed by the weight.
+  static std::size_t weight_of(const std::vector<std::string>& lines, const std::string& suffix) {
+    std::size_t result = 0;
+    for (const auto& line : lines) {
+      std::size_t space = line.rfind(' ');
+      if (space != std::string::npos && space >= suffix.size() &&
+          line.compare(space - suffix.size(), suffix.size(), suffix) == 0) {
+        result += std::stoull(line.substr(space + 1));
+      }
+    }
+    return result;
+  }
+};
+
+} // namespace
+
+TEST_F(profiler_test, shared_ptr_copies) {
+  shared_ptr<profiled_object> p(new profiled_object{42});
+  ownership_profiler::start(1);
+  auto q = p;
+  shared_ptr<profiled_object> r;
+  r = p;
+  ownership_profiler::stop();
+  auto s = p;
+
+  // The copy and the assignment are separate call sites.
+  auto lines = dump();
+  EXPECT_EQ(2, weight_of(lines, "profiled_object;owners 2-3"));
+  ASSERT_EQ(2, lines.size());
+  for (const auto& line : lines) {
+    EXPECT_NE(std::string::npos, line.find("profiler_test_shared_ptr_copies_Test::TestBody()")) << line;
+  }
+}
+
+TEST_F(profiler_test, linked_ptr_copies) {
+  linked_ptr<profiled_object> p(new profiled_object{42});
+  ownership_profiler::start(1);
+  auto q = p;
+  linked_ptr<profiled_object> r;
+  r = p;
+  linked_ptr<profiled_object> s(p);
+  ownership_profiler::stop();
+
+  auto lines = dump();
+  EXPECT_EQ(2, weight_of(lines, "profiled_object;owners 2-3"));
+  EXPECT_EQ(1, weight_of(lines, "profiled_object;owners 4-7"));
+}
+
+TEST_F(profiler_test, nothing_sampled_when_stopped) {
+  shared_ptr<profiled_object> p(new profiled_object{42});
+  linked_ptr<profiled_object> q(new profiled_object{43});
+  for (int i = 0; i < 1000; ++i) {
+    auto p_copy = p;
+    auto q_copy = q;
+  }
+  EXPECT_TRUE(dump().empty());
+}
+
+TEST_F(profiler_test, weights_estimate_copies) {
+  constexpr std::size_t copies = 100000;
+  shared_ptr<profiled_object> p(new profiled_object{42});
+  ownership_profiler::start(100);
+  for (std::size_t i = 0; i < copies; ++i) {
+    auto copy = p;
+  }
+  ownership_profiler::stop();
+
+  std::size_t estimate = weight_of(dump(), "profiled_object;owners 2-3");
+  EXPECT_GT(estimate, copies / 2);
+  EXPECT_LT(estimate, copies * 2);
+}
+
+TEST_F(profiler_test, dump_to_unwritable_path) {
+  EXPECT_FALSE(ownership_profiler::dump("/nonexistent-directory/ownership.folded"));
+}
+
+#endif
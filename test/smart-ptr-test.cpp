@@ -1,34 +1,21 @@
+#include "footprint-budgets.h"
 #include "linked-ptr.h"
 #include "shared-ptr.h"
 #include "test-classes.h"
+#include "typed-smart-ptr-test.h"
 
 #include <gtest/gtest.h>
 
+#include <array>
+#include <cstdint>
+#include <memory_resource>
+
 namespace {
 
 using destruction_tracker_base_deleter = std::default_delete<destruction_tracker_base>;
 
 template <typename IsShared>
-class common_test : public ::testing::Test {
-protected:
-  template <typename T, typename Deleter = std::default_delete<T>>
-  using smart_ptr = std::conditional_t<IsShared::value, shared_ptr<T, Deleter>, linked_ptr<T, Deleter>>;
-  test_object::no_new_instances_guard instances_guard;
-};
-
-using tested_extents = ::testing::Types<std::false_type, std::true_type>;
-
-class extent_name_generator {
-public:
-  template <typename IsShared>
-  static std::string GetName(int) {
-    if (IsShared::value) {
-      return "shared-ptr";
-    } else {
-      return "linked-ptr";
-    }
-  }
-};
+class common_test : public smart_ptr_test<IsShared> {};
 
 TYPED_TEST_SUITE(common_test, tested_extents, extent_name_generator);
 
@@ -185,6 +172,64 @@ TYPED_TEST(common_test, custom_deleter_reset) {
   EXPECT_TRUE(deleted);
 }
 
+TYPED_TEST(common_test, unique) {
+  typename TestFixture::template smart_ptr<test_object> p;
+  EXPECT_FALSE(p.unique());
+  p.reset(new test_object(42));
+  EXPECT_TRUE(p.unique());
+  auto q = p;
+  EXPECT_FALSE(p.unique());
+  EXPECT_FALSE(q.unique());
+  q.reset();
+  EXPECT_TRUE(p.unique());
+}
+
+TYPED_TEST(common_test, try_release_unique) {
+  test_object* ptr = new test_object(42);
+  typename TestFixture::template smart_ptr<test_object> p(ptr);
+  auto released = p.try_release_unique();
+  ASSERT_TRUE(released.has_value());
+  EXPECT_EQ(ptr, released->get());
+  EXPECT_FALSE(static_cast<bool>(p));
+  EXPECT_EQ(0, p.use_count());
+  EXPECT_EQ(42, **released);
+}
+
+TYPED_TEST(common_test, try_release_unique_shared) {
+  typename TestFixture::template smart_ptr<test_object> p(new test_object(42));
+  auto q = p;
+  EXPECT_FALSE(p.try_release_unique().has_value());
+  EXPECT_EQ(2, p.use_count());
+  EXPECT_EQ(42, *p);
+
+  q.reset();
+  EXPECT_TRUE(p.try_release_unique().has_value());
+}
+
+TYPED_TEST(common_test, try_release_unique_empty) {
+  typename TestFixture::template smart_ptr<test_object> p;
+  EXPECT_FALSE(p.try_release_unique().has_value());
+
+  typename TestFixture::template smart_ptr<test_object> q(static_cast<test_object*>(nullptr));
+  auto released = q.try_release_unique();
+  ASSERT_TRUE(released.has_value());
+  EXPECT_EQ(nullptr, released->get());
+}
+
+TYPED_TEST(common_test, try_release_unique_custom_deleter) {
+  bool deleted = false;
+  {
+    auto released = [&deleted] {
+      typename TestFixture::template smart_ptr<test_object, tracking_deleter<test_object>> p(
+          new test_object(42), tracking_deleter<test_object>(&deleted));
+      return p.try_release_unique();
+    }();
+    ASSERT_TRUE(released.has_value());
+    EXPECT_FALSE(deleted);
+  }
+  EXPECT_TRUE(deleted);
+}
+
 TEST(linked_ptr_test, copy_ctor_const) {
   linked_ptr<test_object, std::default_delete<const test_object>> p(new test_object(42));
   linked_ptr<const test_object> q = p;
@@ -297,6 +342,166 @@ TYPED_TEST(common_test, check_lifetime) {
   EXPECT_TRUE(deleted);
 }
 
+namespace {
+
+struct hot_object {
+  int value;
+};
+
+} // namespace
+
+template <>
+struct control_block_layout_traits<hot_object> {
+  static constexpr control_block_layout value = control_block_layout::cache_aligned;
+};
+
+TEST(shared_ptr_test, cache_aligned_control_block) {
+  static_assert(alignof(detail::control_block<std::default_delete<hot_object>, control_block_layout::cache_aligned>) ==
+                detail::destructive_interference_size);
+  static_assert(sizeof(detail::control_block<std::default_delete<hot_object>, control_block_layout::cache_aligned>) ==
+                detail::destructive_interference_size);
+
+  shared_ptr<hot_object> p(new hot_object{42});
+  auto q = p;
+  EXPECT_EQ(2, q.use_count());
+  EXPECT_EQ(42, q->value);
+  q.reset();
+  EXPECT_EQ(1, p.use_count());
+}
+
+TEST(shared_ptr_test, make_shared) {
+  bool deleted = false;
+  {
+    auto p = make_shared<destruction_tracker>(&deleted);
+    auto q = p;
+    EXPECT_EQ(2, p.use_count());
+    EXPECT_FALSE(q.try_release_unique());
+    p.reset();
+    EXPECT_TRUE(q.unique());
+    EXPECT_FALSE(q.try_release_unique());
+    EXPECT_EQ(1, q.use_count());
+  }
+  EXPECT_TRUE(deleted);
+}
+
+TEST(shared_ptr_test, make_shared_cache_aligned) {
+  auto p = make_shared<const hot_object>(hot_object{42});
+  EXPECT_EQ(42, p->value);
+  // The object starts on the line after the counter's.
+  EXPECT_EQ(0, reinterpret_cast<std::uintptr_t>(p.get()) % detail::destructive_interference_size);
+}
+
+TEST(shared_ptr_test, allocate_shared) {
+  std::array<std::byte, 1024> buffer;
+  std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size(), std::pmr::null_memory_resource());
+  bool deleted = false;
+  {
+    auto p = allocate_shared<destruction_tracker>(&arena, &deleted);
+    auto q = p;
+    EXPECT_EQ(2, q.use_count());
+    EXPECT_GE(reinterpret_cast<std::byte*>(p.get()), buffer.data());
+    EXPECT_LT(reinterpret_cast<std::byte*>(p.get()), buffer.data() + buffer.size());
+  }
+  EXPECT_TRUE(deleted);
+}
+
+TEST(shared_ptr_test, pointer_ctor_with_resource) {
+  std::pmr::unsynchronized_pool_resource pool;
+  bool deleted = false;
+  {
+    shared_ptr<int, tracking_deleter<int>> p(new int(42), tracking_deleter<int>(&deleted), &pool);
+    auto q = p;
+    EXPECT_EQ(2, p.use_count());
+  }
+  EXPECT_TRUE(deleted);
+
+  shared_ptr<test_object> p(new test_object(42), std::default_delete<test_object>(), &pool);
+  auto released = p.try_release_unique();
+  ASSERT_TRUE(released);
+  EXPECT_EQ(42, **released);
+  EXPECT_FALSE(p);
+}
+
+namespace {
+
+struct compact_base : destruction_tracker_base {
+  using destruction_tracker_base::destruction_tracker_base;
+};
+
+struct compact_derived : compact_base {
+  using compact_base::compact_base;
+};
+
+using compact_base_deleter = std::default_delete<compact_base>;
+
+} // namespace
+
+template <>
+struct ring_layout_traits<compact_base> {
+  static constexpr ring_layout value = ring_layout::singly_linked;
+};
+
+template <>
+struct ring_layout_traits<compact_derived> {
+  static constexpr ring_layout value = ring_layout::singly_linked;
+};
+
+TEST(linked_ptr_test, singly_linked_ring) {
+  static_assert(sizeof(linked_ptr<compact_base>) + sizeof(void*) == sizeof(linked_ptr<destruction_tracker_base>));
+
+  bool deleted = false;
+  {
+    linked_ptr<compact_base> p(new compact_base(&deleted));
+    EXPECT_EQ(1, p.use_count());
+    linked_ptr<compact_base> q = p;
+    linked_ptr<compact_base> r = q;
+    EXPECT_EQ(3, p.use_count());
+    q.reset();
+    EXPECT_EQ(0, q.use_count());
+    EXPECT_EQ(2, r.use_count());
+    q = r;
+    p = p;
+    EXPECT_EQ(3, p.use_count());
+    p.reset();
+    r.reset();
+    EXPECT_FALSE(deleted);
+    EXPECT_EQ(1, q.use_count());
+  }
+  EXPECT_TRUE(deleted);
+}
+
+TEST(linked_ptr_test, singly_linked_ring_assignment) {
+  bool derived_deleted = false;
+  bool base_deleted = false;
+  {
+    linked_ptr<compact_derived, compact_base_deleter> d(new compact_derived(&derived_deleted));
+    linked_ptr<compact_base, compact_base_deleter> b(new compact_base(&base_deleted));
+    linked_ptr<compact_base, compact_base_deleter> c = d;
+    EXPECT_EQ(2, d.use_count());
+
+    b = d;
+    EXPECT_TRUE(base_deleted);
+    EXPECT_EQ(3, d.use_count());
+    EXPECT_EQ(d.get(), b.get());
+
+    c.reset(new compact_base(&base_deleted));
+    EXPECT_EQ(2, b.use_count());
+    EXPECT_EQ(1, c.use_count());
+  }
+  EXPECT_TRUE(derived_deleted);
+}
+
+TEST(traits_test, shared_ptr_control_block) {
+  using default_block = detail::control_block<std::default_delete<int>, control_block_layout::packed>;
+  static_assert(!std::is_polymorphic_v<default_block>);
+  static_assert(std::is_trivially_destructible_v<default_block>);
+  static_assert(sizeof(default_block) == sizeof(std::atomic<std::size_t>));
+
+  using tracking_block = detail::control_block<tracking_deleter<int>, control_block_layout::packed>;
+  static_assert(!std::is_polymorphic_v<tracking_block>);
+  static_assert(sizeof(tracking_block) == sizeof(std::atomic<std::size_t>) + sizeof(tracking_deleter<int>));
+}
+
 TEST(traits_test, shared_prt_ctors) {
   static_assert(std::is_constructible_v<shared_ptr<int>, int*>);
   static_assert(std::is_constructible_v<shared_ptr<int>, int*, std::default_delete<int>>);
@@ -356,6 +561,12 @@ TEST(traits_test, shared_ptr_assignment) {
                                       shared_ptr<destruction_tracker, destruction_tracker_base_deleter>>);
 }
 
+TEST(traits_test, linked_ptr_ring_layout) {
+  static_assert(std::is_constructible_v<linked_ptr<compact_base>, linked_ptr<compact_derived>>);
+  static_assert(!std::is_constructible_v<linked_ptr<destruction_tracker_base>, linked_ptr<compact_derived>>);
+  static_assert(!std::is_assignable_v<linked_ptr<destruction_tracker_base>, linked_ptr<compact_derived>>);
+}
+
 TEST(traits_test, linked_ptr_assignment) {
   static_assert(std::is_assignable_v<linked_ptr<const int>, linked_ptr<int>>);
   static_assert(!std::is_assignable_v<linked_ptr<int>, linked_ptr<const int>>);
@@ -366,3 +577,24 @@ TEST(traits_test, linked_ptr_assignment) {
   static_assert(std::is_assignable_v<linked_ptr<destruction_tracker_base>,
                                      linked_ptr<destruction_tracker, destruction_tracker_base_deleter>>);
 }
+
+TEST(footprint_test, shared_ptr_handle) {
+  static_assert(sizeof(shared_ptr<int>) <= footprint_budget::shared_ptr_handle);
+  static_assert(sizeof(shared_ptr<int, tracking_deleter<int>>) <= footprint_budget::shared_ptr_handle);
+  static_assert(sizeof(shared_ptr<int, large_deleter<int>>) <= footprint_budget::shared_ptr_handle);
+  static_assert(sizeof(shared_ptr<hot_object>) <= footprint_budget::shared_ptr_handle);
+}
+
+TEST(footprint_test, linked_ptr_handle) {
+  static_assert(sizeof(linked_ptr<int>) <= footprint_budget::linked_ptr_handle);
+  static_assert(sizeof(linked_ptr<int, tracking_deleter<int>>) <=
+                footprint_budget::linked_ptr_handle + sizeof(tracking_deleter<int>));
+  static_assert(sizeof(linked_ptr<int, large_deleter<int>>) <=
+                footprint_budget::linked_ptr_handle + sizeof(large_deleter<int>));
+  static_assert(sizeof(linked_ptr<compact_base>) <= footprint_budget::compact_linked_ptr_handle);
+}
+
+TEST(footprint_test, ring_node) {
+  static_assert(sizeof(detail::ring_node<ring_layout::doubly_linked>) <= footprint_budget::ring_node);
+  static_assert(sizeof(detail::ring_node<ring_layout::singly_linked>) <= footprint_budget::compact_ring_node);
+}
@@ -40,6 +40,15 @@ private:
   bool* deleted{nullptr};
 };
 
+template <typename T>
+struct large_deleter {
+  void operator()(T* object) const {
+    delete object;
+  }
+
+  unsigned char state[64]{};
+};
+
 struct destruction_tracker_base {
   destruction_tracker_base() = default;
 
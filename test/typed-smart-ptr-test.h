@@ -0,0 +1,39 @@
+#pragma once
+
+#include "linked-ptr.h"
+#include "shared-ptr.h"
+#include "test-classes.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <type_traits>
+
+// Base fixture of typed tests that run once with `linked_ptr` and once with `shared_ptr`:
+//
+//   template <typename IsShared>
+//   class my_test : public smart_ptr_test<IsShared> {};
+//
+//   TYPED_TEST_SUITE(my_test, tested_extents, extent_name_generator);
+template <typename IsShared>
+class smart_ptr_test : public ::testing::Test {
+protected:
+  template <typename T, typename Deleter = std::default_delete<T>>
+  using smart_ptr = std::conditional_t<IsShared::value, shared_ptr<T, Deleter>, linked_ptr<T, Deleter>>;
+  test_object::no_new_instances_guard instances_guard;
+};
+
+using tested_extents = ::testing::Types<std::false_type, std::true_type>;
+
+class extent_name_generator {
+public:
+  template <typename IsShared>
+  static std::string GetName(int) {
+    if (IsShared::value) {
+      return "shared-ptr";
+    } else {
+      return "linked-ptr";
+    }
+  }
+};